@@ -4,6 +4,8 @@
 #include "types.h"
 #include "init.h"
 #include "utils.h"
+#include "refcount.h"
+#include "class.h"
 
 #pragma mark KKObject
 
@@ -40,7 +42,7 @@
 		 */
 		objc_debug_log("Updating %s's custom ARR flag to NO\n",
 					   class_getName(self));
-		self->flags.has_custom_arr = NO;
+		OBJC_CLASS_WRITE_FLAG((Class)self, has_custom_arr, NO);
 	}
 }
 
@@ -118,19 +120,19 @@
 -(void)release
 {
 	objc_debug_log("Releasing object %p[%i]\n", self, self->__retain_count);
-	int retain_cnt = __sync_fetch_and_sub(&self->__retain_count, 1);
-	if (retain_cnt == 0){
+	objc_retain_count retain_cnt = objc_retain_count_decrement(self);
+	if (retain_cnt == -1){
 		/* Dealloc */
 		[self dealloc];
-	}else if (retain_cnt < 0){
-		objc_abort("Over-releasing an object %p (%i)!", self, retain_cnt);
+	}else if (retain_cnt < -1){
+		objc_abort("Over-releasing an object %p (%i)!", self, retain_cnt + 1);
 	}
 }
 
 -(id)retain
 {
 	objc_debug_log("Retaining an object %p\n", self);
-	__sync_add_and_fetch(&self->__retain_count, 1);
+	objc_retain_count_increment(self);
 	return self;
 }
 
@@ -1,7 +1,7 @@
 #include "os.h"
 #include "kernobjc/types.h"
 #include "types.h"
-#include "kernobjc/arc.h"
+#include "arc.h"
 #include "kernobjc/message.h"
 #include "selector.h"
 #include "message.h"
@@ -9,6 +9,8 @@
 #include "associative.h"
 #include "init.h"
 #include "blocks.h"
+#include "refcount.h"
+#include "weak.h"
 
 /*
  * Each autorelease pool ~ a page. We need the previous and top
@@ -16,6 +18,12 @@
  */
 #define AUTORELEASE_POOL_SIZE ((PAGE_SIZE / sizeof(void*)) - 2)
 
+/*
+ * Number of objects taken from a pool at once when emptying it. The batch is
+ * kept on the stack.
+ */
+#define AUTORELEASE_POOL_DRAIN_BATCH 64
+
 /* Default hook for _objc_weak_load() */
 static id
 __objc_weak_load_default_hook(id object) { return object; }
@@ -38,16 +46,49 @@ struct objc_autorelease_pool {
 
 struct objc_arc_thread_data {
 	struct objc_autorelease_pool *pool;
+	
+	/*
+	 * Emptied pool pages kept for reuse, linked through their previous
+	 * pointers. At most OBJC_AUTORELEASE_POOL_CACHE_LIMIT pages are kept.
+	 */
+	struct objc_autorelease_pool *free_pages;
+	unsigned int free_page_count;
+	
+	/*
+	 * Object passed to objc_autoreleaseReturnValue() that hasn't been
+	 * autoreleased yet, hoping the caller takes it over by calling
+	 * objc_retainAutoreleasedReturnValue().
+	 */
+	id returned_object;
+	
+	/*
+	 * Autorelease counters of this thread. They are only ever written by
+	 * the owning thread and summed up by objc_autorelease_get_statistics().
+	 */
+	unsigned long objects_pending;
+	unsigned long objects_autoreleased;
+	unsigned long objects_handed_over;
+	unsigned long pages_allocated;
+	unsigned long pages_reused;
+	unsigned int pool_depth;
+	unsigned int pool_peak_depth;
+	
+	/* All thread data are linked together, see objc_arc_thread_data_list. */
+	struct objc_arc_thread_data *next;
+	struct objc_arc_thread_data *previous;
 };
 
-struct object {
-	Class isa;
-	int retain_count;
-};
-
-static int objc_autorelease_object_count = 0;
 static objc_tls_key objc_autorelease_pool_tls_key = 0;
 
+/*
+ * List of the thread data of all threads that use ARC, guarded by
+ * objc_arc_thread_data_lock. The totals of threads that have already exited
+ * are accumulated in objc_exited_threads_statistics.
+ */
+static struct objc_arc_thread_data *objc_arc_thread_data_list;
+static struct objc_autorelease_statistics objc_exited_threads_statistics;
+static objc_rw_lock objc_arc_thread_data_lock;
+
 /* Forward declarations of inline functions: */
 static inline struct objc_autorelease_pool *
 _objc_create_pool_if_necessary(struct objc_arc_thread_data *data);
@@ -60,6 +101,18 @@ _objc_get_arc_thread_data(void){
 	if (data == NULL){
 		data = objc_zero_alloc(sizeof(struct objc_arc_thread_data),
 						  M_AUTORELEASE_POOL_TYPE);
+		if (data == NULL){
+			return NULL;
+		}
+		
+		objc_rw_lock_wlock(&objc_arc_thread_data_lock);
+		data->next = objc_arc_thread_data_list;
+		if (objc_arc_thread_data_list != NULL){
+			objc_arc_thread_data_list->previous = data;
+		}
+		objc_arc_thread_data_list = data;
+		objc_rw_lock_unlock(&objc_arc_thread_data_lock);
+		
 		objc_set_tls_for_key(data, objc_autorelease_pool_tls_key);
 	}
 	return data;
@@ -88,8 +141,7 @@ _objc_retain(id obj)
 	 * that the objects actually have the retain count variable
 	 * directly after the isa pointer.
 	 */
-	struct object *object = (struct object *)obj;
-	__sync_add_and_fetch(&(object->retain_count), 1);
+	objc_retain_count_increment(obj);
 	return obj;
 }
 
@@ -120,13 +172,26 @@ _objc_release(id obj)
 	 * The kernel objc run-time assumes that the objects actually have the
 	 * retain count variable directly after the isa pointer.
 	 */
-	struct object *object = (struct object *)obj;
-	if (__sync_sub_and_fetch(&(object->retain_count), 1) < 0) {
+	if (objc_retain_count_decrement(obj) < 0) {
 		objc_delete_weak_refs(obj);
 		objc_send_dealloc_msg(obj);
 	}
 }
 
+/*
+ * Returns YES if instances of the class are retained and released simply by
+ * changing the inline retain count, i.e. they are neither blocks nor objects
+ * with custom ARR methods.
+ */
+static inline BOOL
+_objc_class_has_inline_retain_count(Class cls)
+{
+	return cls != (Class)&_NSConcreteMallocBlock &&
+	       cls != (Class)&_NSConcreteStackBlock &&
+	       cls != (Class)&_NSConcreteGlobalBlock &&
+	       !cls->flags.has_custom_arr;
+}
+
 static inline id
 _objc_autorelease(id obj)
 {
@@ -145,7 +210,8 @@ _objc_autorelease(id obj)
 		struct objc_autorelease_pool *pool;
 		pool = _objc_create_pool_if_necessary(data);
 		
-		++objc_autorelease_object_count;
+		++data->objects_pending;
+		++data->objects_autoreleased;
 		*pool->top = obj;
 		++pool->top;
 		return obj;
@@ -159,6 +225,82 @@ _objc_autorelease(id obj)
 }
 
 
+/*
+ * Releases the objects, which were taken from a pool in the order they are
+ * to be released. Objects that keep their retain count inline are only
+ * decremented at first, the objects that need to be deallocated are
+ * collected at the beginning of the array and deallocated afterwards.
+ */
+static void
+_objc_release_batch(id *objects, unsigned int count)
+{
+	unsigned int dead_count = 0;
+	Class last_cls = Nil;
+	BOOL last_cls_has_inline_count = NO;
+	
+	for (unsigned int i = 0; i < count; ++i) {
+		id obj = objects[i];
+		if (objc_object_is_small_object(obj)) {
+			continue;
+		}
+		
+		/* Pools usually contain runs of objects of the same class. */
+		Class cls = obj->isa;
+		if (cls != last_cls) {
+			last_cls = cls;
+			last_cls_has_inline_count =
+					_objc_class_has_inline_retain_count(cls);
+		}
+		
+		if (!last_cls_has_inline_count) {
+			_objc_release(obj);
+		}else if (objc_retain_count_decrement(obj) < 0) {
+			objects[dead_count++] = obj;
+		}
+	}
+	
+	for (unsigned int i = 0; i < dead_count; ++i) {
+		objc_delete_weak_refs(objects[i]);
+		objc_send_dealloc_msg(objects[i]);
+	}
+}
+
+/*
+ * Returns a pool page, preferably one from the thread's cache.
+ */
+static inline struct objc_autorelease_pool *
+_objc_pool_page_alloc(struct objc_arc_thread_data *data)
+{
+	struct objc_autorelease_pool *pool = data->free_pages;
+	if (pool != NULL){
+		data->free_pages = pool->previous;
+		--data->free_page_count;
+		++data->pages_reused;
+		return pool;
+	}
+	
+	++data->pages_allocated;
+	return objc_alloc_page(M_AUTORELEASE_POOL_TYPE);
+}
+
+/*
+ * Puts the pool page into the thread's cache, or frees it if the cache is
+ * already full.
+ */
+static inline void
+_objc_pool_page_free(struct objc_arc_thread_data *data,
+		     struct objc_autorelease_pool *pool)
+{
+	if (data->free_page_count < OBJC_AUTORELEASE_POOL_CACHE_LIMIT){
+		pool->previous = data->free_pages;
+		data->free_pages = pool;
+		++data->free_page_count;
+		return;
+	}
+	
+	objc_dealloc(pool, M_AUTORELEASE_POOL_TYPE);
+}
+
 /*
  * Empties autorelease pools until it hits the stop pointer.
  */
@@ -187,54 +329,103 @@ _objc_empty_pool_until(struct objc_arc_thread_data *data, id *stop)
 		}
 	}
 	
-	while (data->pool != stop_pool) {
-		/*
-		 * We need to operate with (data->pool) and not just
-		 * a cached ptr since the release may cause some
-		 * additional autoreleases, which could cause
-		 * a new pool to be installed.
-		 */
-		while (data->pool->top > data->pool->pool) {
-			--data->pool->top;
+	/*
+	 * We need to operate with (data->pool) and not just a cached ptr since
+	 * the release may cause some additional autoreleases, which could cause
+	 * a new pool to be installed. Such pools are emptied and disposed of
+	 * before getting back to the pool they were installed above.
+	 */
+	id batch[AUTORELEASE_POOL_DRAIN_BATCH];
+	while (data->pool != NULL) {
+		struct objc_autorelease_pool *pool = data->pool;
+		id *limit = (pool == stop_pool) ? stop : pool->pool;
+		if (pool->top > limit) {
+			/*
+			 * The batch is moved out of the pool first, so that
+			 * objects autoreleased during the release don't
+			 * overwrite it.
+			 */
+			unsigned int count = 0;
+			while (count < AUTORELEASE_POOL_DRAIN_BATCH &&
+			       pool->top > limit) {
+				--pool->top;
+				batch[count++] = *pool->top;
+			}
 			
-			_objc_release(*data->pool->top);
-			--objc_autorelease_object_count;
+			data->objects_pending -= count;
+			_objc_release_batch(batch, count);
+			continue;
+		}
+		
+		if (pool == stop_pool) {
+			break;
 		}
 		
 		/* Dispose of the pool itself */
-		struct objc_autorelease_pool *pool = data->pool;
 		data->pool = pool->previous;
-		objc_dealloc(pool, M_AUTORELEASE_POOL_TYPE);
+		_objc_pool_page_free(data, pool);
 	}
-	
-	/*
-	 * We've reached a point where data->pool == stop_pool.
-	 * Now, if there actually is a pool to be dealt with, we need
-	 * to reach the stop point in that pool.
-	 */
-	if (data->pool != NULL){
-		while ((stop == NULL || (data->pool->top > stop)) &&
-		       (data->pool->top > data->pool->pool)) {
-			--data->pool->top;
-			
-			_objc_release(*data->pool->top);
-			--objc_autorelease_object_count;
-		}
+}
+
+/*
+ * Autoreleases the object handed over by objc_autoreleaseReturnValue() that
+ * hasn't been taken over by the caller. Must be done before pushing or
+ * popping a pool so that the object ends up in the pool it was returned
+ * within.
+ */
+static inline void
+_objc_flush_returned_object(struct objc_arc_thread_data *data)
+{
+	id obj = data->returned_object;
+	if (obj != nil){
+		data->returned_object = nil;
+		_objc_autorelease(obj);
 	}
 }
 
 /*
- * Empties all the pools in the thread data supplied.
+ * Empties all the pools in the thread data supplied and frees the cached
+ * pool pages along with the thread data.
  */
 static void
 _objc_cleanup_pools(struct objc_arc_thread_data *data)
 {
+	if (data->returned_object != nil){
+		/* There may be no pool to put it into. */
+		_objc_release(data->returned_object);
+		data->returned_object = nil;
+	}
+	
 	if (data->pool != NULL){
 		_objc_empty_pool_until(data, NULL);
 		objc_assert(data->pool == NULL,
 			    "The pool should have been emptied!\n");
-		objc_dealloc(data, M_AUTORELEASE_POOL_TYPE);
 	}
+	
+	while (data->free_pages != NULL){
+		struct objc_autorelease_pool *pool = data->free_pages;
+		data->free_pages = pool->previous;
+		objc_dealloc(pool, M_AUTORELEASE_POOL_TYPE);
+	}
+	
+	objc_rw_lock_wlock(&objc_arc_thread_data_lock);
+	if (data->previous != NULL){
+		data->previous->next = data->next;
+	}else{
+		objc_arc_thread_data_list = data->next;
+	}
+	if (data->next != NULL){
+		data->next->previous = data->previous;
+	}
+	objc_exited_threads_statistics.objects_autoreleased +=
+						data->objects_autoreleased;
+	objc_exited_threads_statistics.objects_handed_over +=
+						data->objects_handed_over;
+	objc_exited_threads_statistics.pages_allocated += data->pages_allocated;
+	objc_exited_threads_statistics.pages_reused += data->pages_reused;
+	objc_rw_lock_unlock(&objc_arc_thread_data_lock);
+	
+	objc_dealloc(data, M_AUTORELEASE_POOL_TYPE);
 }
 
 static inline struct objc_autorelease_pool *
@@ -246,7 +437,7 @@ _objc_create_pool_if_necessary(struct objc_arc_thread_data *data)
 		 * Either there is no pool, or we've run out of space in
 		 * the existing one.
 		 */
-		pool = objc_alloc_page(M_AUTORELEASE_POOL_TYPE);
+		pool = _objc_pool_page_alloc(data);
 		pool->previous = data->pool;
 		pool->top = pool->pool;
 		data->pool = pool;
@@ -265,8 +456,13 @@ objc_autoreleasePoolPush(void)
 {
 	struct objc_arc_thread_data *data = _objc_get_arc_thread_data();
 	if (data != NULL){
+		_objc_flush_returned_object(data);
+		
 		struct objc_autorelease_pool *pool;
 		pool = _objc_create_pool_if_necessary(data);
+		if (++data->pool_depth > data->pool_peak_depth){
+			data->pool_peak_depth = data->pool_depth;
+		}
 		return pool->top;
 	}
 	
@@ -282,7 +478,11 @@ objc_autoreleasePoolPop(void *pool)
 {
 	struct objc_arc_thread_data *data = _objc_get_arc_thread_data();
 	if (data != NULL && data->pool != NULL){
+		_objc_flush_returned_object(data);
 		_objc_empty_pool_until(data, pool);
+		if (data->pool_depth > 0){
+			--data->pool_depth;
+		}
 	}else{
 		objc_log("An issue occurred when popping a pool %p"
 			 " - thread data %p, data->pool %p\n",
@@ -290,6 +490,62 @@ objc_autoreleasePoolPop(void *pool)
 	}
 }
 
+#pragma mark -
+#pragma mark Autorelease Statistics
+
+static void
+_objc_autorelease_add_thread_statistics(struct objc_autorelease_statistics *stats,
+					struct objc_arc_thread_data *data)
+{
+	stats->objects_pending += data->objects_pending;
+	stats->objects_autoreleased += data->objects_autoreleased;
+	stats->objects_handed_over += data->objects_handed_over;
+	stats->pages_allocated += data->pages_allocated;
+	stats->pages_reused += data->pages_reused;
+	stats->pool_depth += data->pool_depth;
+	if (data->pool_peak_depth > stats->pool_peak_depth){
+		stats->pool_peak_depth = data->pool_peak_depth;
+	}
+}
+
+void
+objc_autorelease_get_thread_statistics(struct objc_autorelease_statistics *stats)
+{
+	memset(stats, 0, sizeof(struct objc_autorelease_statistics));
+	
+	struct objc_arc_thread_data *data = (struct objc_arc_thread_data*)
+				objc_get_tls_for_key(objc_autorelease_pool_tls_key);
+	if (data != NULL){
+		_objc_autorelease_add_thread_statistics(stats, data);
+		stats->thread_count = 1;
+	}
+}
+
+void
+objc_autorelease_get_statistics(struct objc_autorelease_statistics *stats)
+{
+	memset(stats, 0, sizeof(struct objc_autorelease_statistics));
+	
+	/*
+	 * The counters are read without synchronizing with the owning threads,
+	 * so the sums are only a snapshot that may be slightly off while the
+	 * other threads are autoreleasing objects.
+	 */
+	objc_rw_lock_rlock(&objc_arc_thread_data_lock);
+	stats->objects_autoreleased =
+			objc_exited_threads_statistics.objects_autoreleased;
+	stats->objects_handed_over =
+			objc_exited_threads_statistics.objects_handed_over;
+	stats->pages_allocated = objc_exited_threads_statistics.pages_allocated;
+	stats->pages_reused = objc_exited_threads_statistics.pages_reused;
+	for (struct objc_arc_thread_data *data = objc_arc_thread_data_list;
+	     data != NULL; data = data->next){
+		_objc_autorelease_add_thread_statistics(stats, data);
+		++stats->thread_count;
+	}
+	objc_rw_lock_unlock(&objc_arc_thread_data_lock);
+}
+
 #pragma mark -
 #pragma mark Ref Count Management
 
@@ -331,6 +587,91 @@ objc_retainAutorelease(id obj)
 	return objc_autorelease(objc_retain(obj));
 }
 
+/*
+ * Returns YES if the code at the return address takes the returned object
+ * over right away, i.e. if it is what clang emits for ARC callers on x86-64:
+ *
+ *	movq	%rax, %rdi
+ *	callq	objc_retainAutoreleasedReturnValue
+ *
+ * The return address only points into the caller of the returning function
+ * if it tail-calls objc_autoreleaseReturnValue(), otherwise this says NO and
+ * the object simply gets autoreleased.
+ */
+static inline BOOL
+_objc_caller_claims_return_value(const void *return_address)
+{
+#if defined(__x86_64__)
+	const uint8_t *code = return_address;
+	if (code[0] != 0x48 || code[1] != 0x89 || code[2] != 0xc7
+		|| code[3] != 0xe8){
+		return NO;
+	}
+	
+	int32_t offset;
+	memcpy(&offset, code + 4, sizeof(offset));
+	return code + 8 + offset == (const uint8_t *)
+					objc_retainAutoreleasedReturnValue;
+#else
+	return NO;
+#endif
+}
+
+/*
+ * Instead of autoreleasing the returned object, it is remembered in the thread
+ * data, if the caller is compiled with ARC and immediately calls
+ * objc_retainAutoreleasedReturnValue() with the object. That call then takes
+ * the ownership over without touching the autorelease pool. Any other caller
+ * gets the object autoreleased.
+ */
+static inline id
+_objc_autorelease_return_value(id obj, const void *return_address)
+{
+	if (obj == nil){
+		return nil;
+	}
+	
+	struct objc_arc_thread_data *data = _objc_get_arc_thread_data();
+	if (data == NULL || !_objc_caller_claims_return_value(return_address)){
+		return _objc_autorelease(obj);
+	}
+	
+	_objc_flush_returned_object(data);
+	data->returned_object = obj;
+	return obj;
+}
+
+id
+objc_autoreleaseReturnValue(id obj)
+{
+	return _objc_autorelease_return_value(obj, __builtin_return_address(0));
+}
+
+id
+objc_retainAutoreleaseReturnValue(id obj)
+{
+	return _objc_autorelease_return_value(objc_retain(obj),
+										  __builtin_return_address(0));
+}
+
+id
+objc_retainAutoreleasedReturnValue(id obj)
+{
+	struct objc_arc_thread_data *data = (struct objc_arc_thread_data*)
+				objc_get_tls_for_key(objc_autorelease_pool_tls_key);
+	if (data != NULL && obj != nil && data->returned_object == obj){
+		/* The reference held by the callee is handed over. */
+		data->returned_object = nil;
+		++data->objects_handed_over;
+		return obj;
+	}
+	if (data != NULL){
+		/* Some other object was returned - nobody is going to claim it. */
+		_objc_flush_returned_object(data);
+	}
+	return objc_retain(obj);
+}
+
 id
 objc_storeStrong(id *addr, id value)
 {
@@ -345,87 +686,138 @@ objc_storeStrong(id *addr, id value)
 #pragma mark Weak Refs
 
 /*
- * We are using a special association type to implement weak refs.
- * This association type zeroes the *addr on objc_remove_associated_objects().
- *
- * We need to store the same value for key and value in the associated object.
- * To simply remove the weak ref, store nil into the value for key.
+ * Weak references are kept in the striped weak reference table (see weak.h).
+ * The weak variables are only ever modified with the stripe of the object they
+ * point to locked for writing.
  */
-objc_rw_lock objc_weak_refs_lock;
+
+/*
+ * Marks the class as having weakly referenced instances, so that their
+ * deallocation checks the weak reference table.
+ */
+static inline void
+_objc_weak_mark_class(Class cls)
+{
+	cls = objc_class_get_nonfake_inline(cls);
+	if (!cls->flags.has_weak_refs){
+		OBJC_CLASS_SET_FLAG(cls, has_weak_refs);
+	}
+}
 
 id
 objc_storeWeak(id *addr, id obj)
 {
-	OBJC_LOCK_FOR_SCOPE(&objc_weak_refs_lock);
+	/*
+	 * If this is a global block, it's never deallocated, so secretly make
+	 * this a strong reference. The same goes for small objects.
+	 * TODO: We probably also want to do the same for constant strings and
+	 * classes.
+	 */
+	Class cl = objc_object_get_class_inline(obj);
+	BOOL is_strong = obj == nil || objc_object_is_small_object(obj) ||
+				&_NSConcreteGlobalBlock == cl;
+	if (!is_strong){
+		_objc_weak_mark_class(cl);
+	}
 	
-	id old = *addr;
-	if (obj == nil){
-		/* Remove the reference by setting it to nil */
-		objc_set_associated_object(old, addr, nil,
-					   OBJC_ASSOCIATION_WEAK_REF);
-		*addr = nil;
-		return nil;
+	id old;
+	while (YES){
+		old = *addr;
+		objc_weak_table_lock(old, obj, YES);
+		if (*addr == old){
+			break;
+		}
+		
+		/* Someone has modified the variable in the meantime. */
+		objc_weak_table_unlock(old, obj);
 	}
 	
-	Class cl = objc_object_get_class_inline(obj);
-	if (&_NSConcreteGlobalBlock == cl){
-		// If this is a global block, it's never deallocated, so secretly make
-		// this a strong reference
-		// TODO: We probably also want to do the same for constant strings and
-		// classes.
-		*addr = obj;
-		return obj;
+	if (old != nil && !objc_object_is_small_object(old)){
+		objc_weak_table_unregister_no_lock(old, addr);
 	}
 	
-	if (&_NSConcreteMallocBlock == cl){
-		obj = block_load_weak(obj);
-	}else if (cl->flags.has_custom_arr){
-		obj = _objc_weak_load(obj);
-	}else{
-		if (((struct object*)obj)->retain_count < 0){
-			obj = nil;
+	id value = obj;
+	if (!is_strong){
+		if (&_NSConcreteMallocBlock == cl){
+			value = block_load_weak(obj);
+		}else if (cl->flags.has_custom_arr){
+			value = _objc_weak_load(obj);
+		}else if (objc_retain_count_is_deallocating(obj)){
+			value = nil;
+		}
+		
+		if (value != nil){
+			objc_weak_table_register_no_lock(value, addr);
 		}
 	}
 	
-	objc_set_associated_object(obj, addr, (id)addr,
-				   OBJC_ASSOCIATION_WEAK_REF);
-	*addr = obj;
+	*addr = value;
+	objc_weak_table_unlock(old, obj);
 	
-	return obj;
+	return value;
 }
 
 void
 objc_delete_weak_refs(id obj)
 {
-	OBJC_LOCK_FOR_SCOPE(&objc_weak_refs_lock);
+	if (objc_object_is_small_object(obj)){
+		return;
+	}
+	
+	Class cl = objc_class_get_nonfake_inline(obj->isa);
+	if (!cl->flags.has_weak_refs){
+		/* No instance of the class has ever been weakly referenced. */
+		return;
+	}
 	
-	objc_remove_associated_weak_refs(obj);
+	objc_weak_table_clear(obj);
 }
 
 id
 objc_loadWeakRetained(id *addr)
 {
-	OBJC_LOCK_FOR_SCOPE(&objc_weak_refs_lock);
-	
-	id obj = *addr;
-	if (obj == nil){
-		return nil;
+	id obj;
+	while (YES){
+		obj = *addr;
+		if (obj == nil){
+			return nil;
+		}
+		
+		if (objc_object_is_small_object(obj)){
+			return obj;
+		}
+		
+		objc_weak_table_lock(obj, nil, NO);
+		if (*addr == obj){
+			break;
+		}
+		objc_weak_table_unlock(obj, nil);
 	}
 	
-	if (objc_object_is_small_object(obj)){
-		return obj;
+	/*
+	 * The stripe lock only keeps the object from being freed, the retain
+	 * itself must not race with the last release.
+	 *
+	 * A lock-free load (retain, then check that *addr still points to the
+	 * object) isn't safe: the object may be cleared from the weak table and
+	 * freed between reading *addr and the retain, and nothing defers the free,
+	 * so the retain would write to memory that may already belong to another
+	 * allocation. The deallocating state only helps while the object is still
+	 * allocated. It's a read lock, so loads of the same object don't
+	 * serialize; only the stores and the clearing on deallocation exclude them.
+	 */
+	id result = nil;
+	Class cl = obj->isa;
+	if (&_NSConcreteMallocBlock == cl){
+		result = objc_retain(block_load_weak(obj));
+	}else if (cl->flags.has_custom_arr){
+		result = objc_retain(_objc_weak_load(obj));
+	}else if (objc_retain_count_try_increment(obj)){
+		result = obj;
 	}
 	
-	// TODO malloc block
-	
-	if (obj->isa->flags.has_custom_arr){
-		obj = _objc_weak_load(obj);
-	}else{
-		if (((struct object *)obj)->retain_count < 0){
-			return nil;
-		}
-	}
-	return objc_retain(obj);
+	objc_weak_table_unlock(obj, nil);
+	return result;
 }
 
 id
@@ -443,20 +835,26 @@ objc_copyWeak(id *dest, id *src)
 void
 objc_moveWeak(id *dest, id *src)
 {
-	OBJC_LOCK_FOR_SCOPE(&objc_weak_refs_lock);
-	
-	id obj = *src;
+	id obj;
+	while (YES){
+		obj = *src;
+		objc_weak_table_lock(obj, nil, YES);
+		if (*src == obj){
+			break;
+		}
+		objc_weak_table_unlock(obj, nil);
+	}
 	
-	*dest = *src;
+	*dest = obj;
 	*src = nil;
 	
-	if (obj != nil){
-		/* Set nil for the old reference and add the new reference */
-		objc_set_associated_object(obj, src, nil,
-					   OBJC_ASSOCIATION_WEAK_REF);
-		objc_set_associated_object(obj, dest, (id)dest,
-					   OBJC_ASSOCIATION_WEAK_REF);
+	if (obj != nil && !objc_object_is_small_object(obj)){
+		/* Replace the old reference with the new one */
+		objc_weak_table_unregister_no_lock(obj, src);
+		objc_weak_table_register_no_lock(obj, dest);
 	}
+	
+	objc_weak_table_unlock(obj, nil);
 }
 
 void
@@ -477,7 +875,7 @@ id objc_initWeak(id *object, id value)
 void
 objc_arc_init(void)
 {
-	objc_rw_lock_init(&objc_weak_refs_lock, "objc_weak_refs_lock");
+	objc_rw_lock_init(&objc_arc_thread_data_lock, "objc_arc_thread_data_lock");
 	objc_register_tls(&objc_autorelease_pool_tls_key,
 			  (objc_tls_descructor)_objc_cleanup_pools);
 }
@@ -485,7 +883,9 @@ objc_arc_init(void)
 void
 objc_arc_destroy(void)
 {
-	objc_rw_lock_destroy(&objc_weak_refs_lock);
 	objc_deregister_tls(objc_autorelease_pool_tls_key);
+	
+	/* Deregistering the TLS cleans up the thread data of all threads. */
+	objc_rw_lock_destroy(&objc_arc_thread_data_lock);
 }
 
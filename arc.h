@@ -0,0 +1,19 @@
+/*
+ * This header file contains private declarations of the ARC support,
+ * mostly related to the autorelease pools.
+ */
+
+#ifndef OBJC_ARC_PRIVATE_H_
+#define OBJC_ARC_PRIVATE_H_
+
+#include "kernobjc/arc.h"
+
+/*
+ * Maximum number of emptied autorelease pool pages each thread keeps around
+ * for reuse. Pages popped beyond this count are returned to the allocator.
+ */
+#ifndef OBJC_AUTORELEASE_POOL_CACHE_LIMIT
+	#define OBJC_AUTORELEASE_POOL_CACHE_LIMIT 4
+#endif
+
+#endif /* !OBJC_ARC_PRIVATE_H_ */
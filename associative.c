@@ -11,14 +11,18 @@
 #include "utils.h"
 #include "init.h"
 
-/* Needed for lock name allocations. */
-#define POOL_TYPE char
-#define POOL_NAME objc_associative
-#define POOL_MALLOC_TYPE M_FAKE_CLASS_TYPE
-#define POOL_FREE_FORM_SIZE 1
-#include "pool.h"
+/*
+ * When enabled, each reference list lock gets a name of its own, containing
+ * the object's class name and address, which helps when debugging lock order
+ * issues. The names are allocated and freed along with the lock. Otherwise,
+ * all the list locks share a static name.
+ */
+#ifndef OBJC_UNIQUE_LOCK_NAMES
+	#define OBJC_UNIQUE_LOCK_NAMES 0
+#endif
 
-#define REF_CNT 10
+/* Number of references kept inline before switching to a hash table. */
+#define REF_INLINE_CNT 4
 
 struct reference {
 	void	*key;
@@ -27,14 +31,253 @@ struct reference {
 	objc_AssociationPolicy policy;
 };
 
-struct reference_list {
-	struct reference_list	*next;
+/*
+ * Open-addressed hash table of references, used once an object has more than
+ * REF_INLINE_CNT keys. Keys are never removed - removing an association only
+ * sets its value to nil - so readers can probe the table without a lock.
+ * Tables replaced by bigger ones are kept until the object goes away, since
+ * some reader may still be probing them.
+ */
+struct reference_table {
+	struct reference_table	*retired_next;
 	
+	unsigned int		size; /* Power of two. */
+	unsigned int		used;
+	
+	struct reference	refs[];
+};
+
+struct reference_list {
 	objc_rw_lock		lock;
 	
-	struct reference	refs[REF_CNT];
+	/* NULL while all the references fit into refs. */
+	struct reference_table	*volatile table;
+	
+	/* Filled in order, the first NULL key ends the list. */
+	struct reference	refs[REF_INLINE_CNT];
+};
+
+static const char *const objc_assoc_list_lock_name = "objc_assoc_list_lock";
+
+/*
+ * Initializes the list's lock. The locks of two lists may be held at once
+ * (e.g. by an atomic getter sending -copy), which is fine even if they share
+ * the name.
+ */
+static void
+_objc_reference_list_lock_init(struct reference_list *list, id object)
+{
+#if OBJC_UNIQUE_LOCK_NAMES
+	const char *class_name = object_getClassName(object);
+	
+	/* Prefix, class name, two '_', 0x + pointer in hex and NULL-termination. */
+	size_t name_len = objc_strlen(objc_assoc_list_lock_name)
+					+ objc_strlen(class_name) + 2 + (sizeof(void*) * 2) + 2 + 1;
+	char *name = objc_alloc(name_len, M_FAKE_CLASS_TYPE);
+	
+	/* Interestingly, the preprocessor uses some builtin snprintf, which
+	 * segfaults, which might be a temporary Clang bug, though...
+	 */
+	int(*fn)(char*,size_t,const char*,...) = objc_format_string;
+	fn(name, name_len, "%s_%s_%p", objc_assoc_list_lock_name, class_name,
+	   object);
+	
+	objc_debug_log("Created lock name: %s\n", name);
+	objc_rw_lock_init(&list->lock, name);
+#else
+	objc_rw_lock_init_dupok(&list->lock, objc_assoc_list_lock_name);
+#endif
+}
+
+static void
+_objc_reference_list_lock_destroy(struct reference_list *list)
+{
+#if OBJC_UNIQUE_LOCK_NAMES
+	char *name = (char*)objc_rw_lock_get_name(&list->lock);
+	objc_rw_lock_destroy(&list->lock);
+	objc_dealloc(name, M_FAKE_CLASS_TYPE);
+#else
+	objc_rw_lock_destroy(&list->lock);
+#endif
+}
+
+#if OBJC_ASSOCIATED_OBJECTS_SIDE_TABLE
+
+/* Must be a power of two. */
+#define OBJC_ASSOC_TABLE_STRIPES 64
+
+struct objc_assoc_entry {
+	struct objc_assoc_entry	*next;
+	id						object;
+	
+	struct reference_list	list;
 };
 
+/*
+ * Global table of the instances' associated objects, keyed by the object's
+ * address. Each stripe is a chained hash table of its own, aligned to a cache
+ * line so that the stripe locks don't share one. The stripe lock only guards
+ * the chains, the reference lists are guarded by their own locks.
+ */
+struct objc_assoc_stripe {
+	objc_rw_lock				lock;
+	struct objc_assoc_entry		**buckets;
+	unsigned int				size;
+	unsigned int				used;
+} __attribute__((aligned(64)));
+
+static struct objc_assoc_stripe objc_assoc_table[OBJC_ASSOC_TABLE_STRIPES];
+
+/*
+ * The high bits select the stripe, the low bits the bucket.
+ */
+static inline uint32_t
+_objc_assoc_hash(id object)
+{
+	return (uint32_t)objc_hash_pointer(object) * 0x9E3779B1;
+}
+
+static inline struct objc_assoc_stripe *
+_objc_assoc_stripe_for_object(id object)
+{
+	unsigned int index = _objc_assoc_hash(object) >> 26;
+	return &objc_assoc_table[index & (OBJC_ASSOC_TABLE_STRIPES - 1)];
+}
+
+static inline struct objc_assoc_entry **
+_objc_assoc_stripe_bucket(struct objc_assoc_stripe *stripe, id object)
+{
+	return &stripe->buckets[_objc_assoc_hash(object) & (stripe->size - 1)];
+}
+
+/*
+ * Returns the pointer that points to the object's entry (either the bucket,
+ * or the previous entry's next), or NULL. Needs the stripe locked.
+ */
+static struct objc_assoc_entry **
+_objc_assoc_stripe_find(struct objc_assoc_stripe *stripe, id object)
+{
+	if (stripe->size == 0){
+		return NULL;
+	}
+	
+	struct objc_assoc_entry **link = _objc_assoc_stripe_bucket(stripe, object);
+	while (*link != NULL){
+		if ((*link)->object == object){
+			return link;
+		}
+		link = &(*link)->next;
+	}
+	return NULL;
+}
+
+/*
+ * Keeps the stripe at one entry per bucket on average.
+ */
+static void
+_objc_assoc_stripe_grow_if_necessary(struct objc_assoc_stripe *stripe)
+{
+	if (stripe->used < stripe->size){
+		return;
+	}
+	
+	struct objc_assoc_entry **old_buckets = stripe->buckets;
+	unsigned int old_size = stripe->size;
+	
+	stripe->size = old_size == 0 ? 16 : old_size * 2;
+	stripe->buckets = objc_zero_alloc(stripe->size *
+				sizeof(struct objc_assoc_entry *), M_REFLIST_TYPE);
+	
+	for (unsigned int i = 0; i < old_size; ++i){
+		struct objc_assoc_entry *entry = old_buckets[i];
+		while (entry != NULL){
+			struct objc_assoc_entry *next = entry->next;
+			struct objc_assoc_entry **bucket;
+			bucket = _objc_assoc_stripe_bucket(stripe, entry->object);
+			entry->next = *bucket;
+			*bucket = entry;
+			entry = next;
+		}
+	}
+	
+	if (old_buckets != NULL){
+		objc_dealloc(old_buckets, M_REFLIST_TYPE);
+	}
+}
+
+/*
+ * Returns the object's reference list from the global table. If there is
+ * none and create == YES, it gets created and the object's class is marked
+ * with has_associated_objects.
+ */
+static struct reference_list *
+_objc_assoc_table_list_for_object(id object, BOOL create)
+{
+	struct objc_assoc_stripe *stripe = _objc_assoc_stripe_for_object(object);
+	
+	objc_rw_lock_rlock(&stripe->lock);
+	struct objc_assoc_entry **link = _objc_assoc_stripe_find(stripe, object);
+	struct objc_assoc_entry *entry = link == NULL ? NULL : *link;
+	objc_rw_lock_unlock(&stripe->lock);
+	
+	if (entry != NULL || !create){
+		return entry == NULL ? NULL : &entry->list;
+	}
+	
+	Class cl = objc_object_get_nonfake_class_inline(object);
+	if (!cl->flags.has_associated_objects){
+		OBJC_CLASS_SET_FLAG(cl, has_associated_objects);
+	}
+	
+	objc_rw_lock_wlock(&stripe->lock);
+	link = _objc_assoc_stripe_find(stripe, object);
+	if (link != NULL){
+		/* Someone was faster. */
+		entry = *link;
+	}else{
+		entry = objc_zero_alloc(sizeof(struct objc_assoc_entry),
+								M_REFLIST_TYPE);
+		entry->object = object;
+		
+		_objc_reference_list_lock_init(&entry->list, object);
+		
+		_objc_assoc_stripe_grow_if_necessary(stripe);
+		
+		struct objc_assoc_entry **bucket;
+		bucket = _objc_assoc_stripe_bucket(stripe, object);
+		entry->next = *bucket;
+		*bucket = entry;
+		++stripe->used;
+	}
+	objc_rw_lock_unlock(&stripe->lock);
+	
+	return &entry->list;
+}
+
+/*
+ * Removes the object's entry from the global table and returns it, or NULL
+ * if the object has none.
+ */
+static struct objc_assoc_entry *
+_objc_assoc_table_remove(id object)
+{
+	struct objc_assoc_stripe *stripe = _objc_assoc_stripe_for_object(object);
+	
+	objc_rw_lock_wlock(&stripe->lock);
+	struct objc_assoc_entry **link = _objc_assoc_stripe_find(stripe, object);
+	struct objc_assoc_entry *entry = NULL;
+	if (link != NULL){
+		entry = *link;
+		*link = entry->next;
+		--stripe->used;
+	}
+	objc_rw_lock_unlock(&stripe->lock);
+	
+	return entry;
+}
+
+#else
+
 /*
  * Associated objects install a fake class for each object that uses them.
  *
@@ -77,48 +320,10 @@ _objc_associated_object_cxx_destruct(id self, SEL _cmd)
 	objc_dealloc(cl, M_FAKE_CLASS_TYPE);
 }
 
+#endif /* OBJC_ASSOCIATED_OBJECTS_SIDE_TABLE */
 
-/*
- * Returns a unique name for a lock based on the class name and object pointer.
- */
-static inline char *
-_objc_unique_lock_name_for_object(id object, Class cl)
-{
-	/*
-	 * The lock names need to be unique, so we're actually allocating the
-	 * name. We have a common prefix, that is suffixed by the object's
-	 * class' name and a hex of the obj pointer.
-	 */
-	const char *name_prefix = "objc_assoc_fake_class_lock_";
-	const char *class_name = object_getClassName(object);
-	
-	/* We need a format 0x1234 - 0x == 2 + sizeof(void*)*2 */
-	unsigned pointer_str_len = ((sizeof(void*) * 2) + 2);
-	char pointer_str[pointer_str_len];
-	
-	/* Interestingly, the preprocessor uses some builtin snprintf, which
-	 * segfaults, which might be a temporary Clang bug, though...
-	 */
-	int(*fn)(char*,size_t,const char*,...) = objc_format_string;
-	fn(pointer_str, pointer_str_len - 1, "%p", object);
-	
-	pointer_str[pointer_str_len] = '\0'; /* NULL termination */
-	
-	/* Now concat it */
-	unsigned int name_prefix_len = objc_strlen(name_prefix);
-	unsigned int class_name_len = objc_strlen(class_name);
-	unsigned int lock_name_len = name_prefix_len + class_name_len
-	+ pointer_str_len;
-	
-	char *lock_name = objc_associative_pool_alloc(lock_name_len);
-	objc_copy_memory(lock_name, name_prefix, name_prefix_len);
-	objc_copy_memory(lock_name + name_prefix_len, class_name,
-					 class_name_len);
-	objc_copy_memory(lock_name + name_prefix_len + class_name_len,
-					 pointer_str, pointer_str_len + 1); /* +1 for NULL-term */
-	
-	return lock_name;
-}
+
+#if !OBJC_ASSOCIATED_OBJECTS_SIDE_TABLE
 
 /*
  * Looks for the fake class in the class hierarchy. If not found
@@ -131,7 +336,7 @@ _objc_class_for_object(id object, BOOL create)
 	struct objc_assoc_fake_class *cl;
 	cl = (struct objc_assoc_fake_class *)_objc_find_class_for_object(object);
 	if (cl == NULL && create){
-		volatile int *spin_lock = lock_for_pointer(object);
+		struct objc_spinlock *spin_lock = lock_for_pointer(object);
 		lock_spinlock(spin_lock);
 		
 		cl = (struct objc_assoc_fake_class*)_objc_find_class_for_object(object);
@@ -148,11 +353,7 @@ _objc_class_for_object(id object, BOOL create)
 		cl->flags.fake = YES;
 		cl->flags.resolved = YES;
 		
-		char *lock_name = _objc_unique_lock_name_for_object(object, superclass);
-		objc_debug_log("Created lock name: %s\n", lock_name);
-		
-		objc_rw_lock_init(&cl->list.lock,
-						  lock_name);
+		_objc_reference_list_lock_init(&cl->list, object);
 		
 		object->isa = (Class)cl;
 		unlock_spinlock(spin_lock);
@@ -170,6 +371,8 @@ _objc_class_for_object(id object, BOOL create)
 	return (Class)cl;
 }
 
+#endif /* !OBJC_ASSOCIATED_OBJECTS_SIDE_TABLE */
+
 /*
  * Returns a reference to the objc_object_ref_list struct for
  * that particular object, or NULL if none exists and create == NULL.
@@ -191,21 +394,16 @@ _objc_ref_list_for_object(id object, BOOL create)
 			struct reference_list *list;
 			list = objc_zero_alloc(sizeof(struct reference_list),
 									M_REFLIST_TYPE);
-			
-			/*
-			 * The lock names need to be unique, so we're actually allocating the
-			 * name. We have a common prefix, that is suffixed by the object's
-			 * class' name and a hex of the obj pointer.
-			 */
-			
-			objc_rw_lock_init(&list->lock,
-							  _objc_unique_lock_name_for_object(object, cl));
+			_objc_reference_list_lock_init(list, object);
 			
 			*extra_space = list;
 		}
 		return *extra_space;
 	}
 	
+#if OBJC_ASSOCIATED_OBJECTS_SIDE_TABLE
+	return _objc_assoc_table_list_for_object(object, create);
+#else
 	/*
 	 * It's not a class, create a fake class and update the isa pointer
 	 * (if create == YES)
@@ -215,6 +413,7 @@ _objc_ref_list_for_object(id object, BOOL create)
 		return &((struct objc_assoc_fake_class*)cl)->list;
 	}
 	return NULL;
+#endif
 }
 
 /*
@@ -245,83 +444,173 @@ _objc_dispose_of_object_according_to_policy(id object,
 	}
 }
 
+/*
+ * Returns the references and their count - either the inline ones, or the
+ * hash table's. Unused references have a NULL key.
+ */
 static inline struct reference *
-_objc_find_key_reference_in_list(struct reference_list *list, void *key)
+_objc_references_in_list(struct reference_list *list, unsigned int *count)
 {
-	while (list != NULL){
-		for (int i = 0; i < REF_CNT; ++i){
-			if (list->refs[i].key == key){
-				return &list->refs[i];
-			}
-		}
-		list = list->next;
+	struct reference_table *table = list->table;
+	if (table == NULL){
+		*count = REF_INLINE_CNT;
+		return list->refs;
 	}
-	return NULL;
+	*count = table->size;
+	return table->refs;
 }
 
+/*
+ * Lock-free. The returned reference stays valid until the associated objects
+ * of the object are removed.
+ */
 static inline struct reference *
-_objc_find_free_reference_in_list(struct reference_list *list, BOOL create)
+_objc_find_key_reference_in_list(struct reference_list *list, void *key)
 {
-	while (list != NULL){
-		for (int i = 0; i < REF_CNT; ++i){
-			if (list->refs[i].key == NULL){
+	struct reference_table *table = list->table;
+	if (table == NULL){
+		for (int i = 0; i < REF_INLINE_CNT; ++i){
+			void *ref_key = list->refs[i].key;
+			if (ref_key == key){
 				return &list->refs[i];
 			}
+			if (ref_key == NULL){
+				break;
+			}
 		}
-		
-		/*
-		 * Haven't found any free ref field and we're at the end of the
-		 * linked list - if creation is allowed, allocate.
-		 */
-		if (list->next == NULL && create){
-			list->next = objc_zero_alloc(sizeof(struct reference_list),
-										 M_REFLIST_TYPE);
-			return &list->next->refs[0];
+		return NULL;
+	}
+	
+	unsigned int mask = table->size - 1;
+	unsigned int i = objc_hash_pointer(key) & mask;
+	while (table->refs[i].key != NULL){
+		if (table->refs[i].key == key){
+			return &table->refs[i];
 		}
-		
-		list = list->next;
+		i = (i + 1) & mask;
 	}
 	return NULL;
 }
 
+/*
+ * Fills the reference and publishes it by storing the key last, so that
+ * lock-free readers never see the key with a stale value.
+ */
+static inline void
+_objc_publish_reference(struct reference *ref, void *key, void *value,
+						objc_AssociationPolicy policy)
+{
+	ref->value = value;
+	ref->policy = policy;
+	__sync_synchronize();
+	ref->key = key;
+}
+
+static void
+_objc_table_insert_reference(struct reference_table *table, void *key,
+							 void *value, objc_AssociationPolicy policy)
+{
+	unsigned int mask = table->size - 1;
+	unsigned int i = objc_hash_pointer(key) & mask;
+	while (table->refs[i].key != NULL){
+		i = (i + 1) & mask;
+	}
+	_objc_publish_reference(&table->refs[i], key, value, policy);
+	++table->used;
+}
+
+/*
+ * Replaces the current references with a hash table twice as big (or a new
+ * one when the inline references are full). References without a value are
+ * dropped.
+ */
 static void
-_objc_remove_associative_list(struct reference_list *prev,
-							  struct reference_list *list,
-							  volatile int *lock,
-							  BOOL free){
-	if (list->next != NULL){
-		_objc_remove_associative_list(list, list->next, lock, free);
+_objc_grow_reference_table(struct reference_list *list)
+{
+	unsigned int count;
+	struct reference *refs = _objc_references_in_list(list, &count);
+	struct reference_table *old_table = list->table;
+	
+	unsigned int size = old_table == NULL ? 16 : old_table->size * 2;
+	struct reference_table *table = objc_zero_alloc(
+				sizeof(struct reference_table)
+				+ size * sizeof(struct reference), M_REFLIST_TYPE);
+	table->size = size;
+	table->retired_next = old_table;
+	
+	for (unsigned int i = 0; i < count; ++i){
+		if (refs[i].key != NULL && refs[i].value != NULL){
+			_objc_table_insert_reference(table, refs[i].key, refs[i].value,
+										 refs[i].policy);
+		}
 	}
 	
-	/*
-	 * Need to lock it for the pointer reassignement.
-	 */
-	if (prev != NULL){
-		lock_spinlock(lock);
-		prev->next = list->next;
-		unlock_spinlock(lock);
+	__sync_synchronize();
+	list->table = table;
+}
+
+/*
+ * Adds a reference for a key that isn't in the list yet. Needs the list
+ * locked for writing.
+ */
+static void
+_objc_add_reference_to_list(struct reference_list *list, void *key,
+							void *value, objc_AssociationPolicy policy)
+{
+	if (list->table == NULL){
+		for (int i = 0; i < REF_INLINE_CNT; ++i){
+			if (list->refs[i].key == NULL){
+				_objc_publish_reference(&list->refs[i], key, value, policy);
+				return;
+			}
+		}
+		_objc_grow_reference_table(list);
+	}else if ((list->table->used + 1) * 4 > list->table->size * 3){
+		_objc_grow_reference_table(list);
 	}
 	
-	for (int i = 0; i < REF_CNT; ++i){
-		struct reference *ref = &list->refs[i];
+	_objc_table_insert_reference(list->table, key, value, policy);
+}
+
+/*
+ * Frees the hash table, along with the retired ones, and clears the inline
+ * references.
+ */
+static void
+_objc_free_reference_tables(struct reference_list *list)
+{
+	struct reference_table *table = list->table;
+	while (table != NULL){
+		struct reference_table *retired = table->retired_next;
+		objc_dealloc(table, M_REFLIST_TYPE);
+		table = retired;
+	}
+	list->table = NULL;
+	objc_memory_zero(list->refs, sizeof(list->refs));
+}
+
+/*
+ * Disposes of all the values and frees the hash tables.
+ */
+static void
+_objc_remove_references_in_list(struct reference_list *list)
+{
+	unsigned int count;
+	struct reference *refs = _objc_references_in_list(list, &count);
+	for (unsigned int i = 0; i < count; ++i){
+		struct reference *ref = &refs[i];
 		if (ref->key != NULL){
 			_objc_dispose_of_object_according_to_policy(ref->value,
 														ref->policy);
 		}
-		ref->key = NULL;
-		ref->value = NULL;
-		ref->policy = 0;
 	}
 	
-	if (free){
-		objc_dealloc(list, M_REFLIST_TYPE);
-	}
+	_objc_free_reference_tables(list);
 }
 
 static inline void
 _objc_remove_associative_lists_for_object(id object)
 {
-	volatile int *spin_lock = lock_for_pointer(object);
 	if (object->isa->flags.meta){
 		void **extra_space;
 		extra_space = objc_class_extra_with_identifier((Class)object,
@@ -331,20 +620,21 @@ _objc_remove_associative_lists_for_object(id object)
 		}
 		
 		struct reference_list *list = *extra_space;
-		if (list->next != NULL){
-			_objc_remove_associative_list(list,
-										  list->next,
-										  spin_lock,
-										  NO);
-		}
-		
-		objc_rw_lock_destroy(&list->lock);
-		_objc_remove_associative_list(NULL,
-									  list,
-									  spin_lock,
-									  YES);
+		_objc_reference_list_lock_destroy(list);
+		_objc_remove_references_in_list(list);
+		objc_dealloc(list, M_REFLIST_TYPE);
 		*extra_space = NULL;
 	}else{
+#if OBJC_ASSOCIATED_OBJECTS_SIDE_TABLE
+		struct objc_assoc_entry *entry = _objc_assoc_table_remove(object);
+		if (entry == NULL){
+			return;
+		}
+		
+		_objc_reference_list_lock_destroy(&entry->list);
+		_objc_remove_references_in_list(&entry->list);
+		objc_dealloc(entry, M_REFLIST_TYPE);
+#else
 		struct objc_assoc_fake_class *cl;
 		cl = (struct objc_assoc_fake_class*)
 		_objc_class_for_object(object, NO);
@@ -352,15 +642,9 @@ _objc_remove_associative_lists_for_object(id object)
 			return;
 		}
 		
-		if (cl->list.next != NULL){
-			_objc_remove_associative_list(&cl->list, cl->list.next,
-										  spin_lock, YES);
-		}
-		
-		objc_rw_lock_destroy(&cl->list.lock);
-		
-		_objc_remove_associative_list(NULL, &cl->list,
-									  spin_lock, NO);
+		_objc_reference_list_lock_destroy(&cl->list);
+		_objc_remove_references_in_list(&cl->list);
+#endif
 	}
 }
 
@@ -386,11 +670,7 @@ objc_get_associated_object(id object, void *key)
 		return nil;
 	}
 	
-	objc_rw_lock_rlock(&list->lock);
 	struct reference *ref = _objc_find_key_reference_in_list(list, key);
-	objc_rw_lock_unlock(&list->lock);
-	
-	
 	if (ref != NULL){
 		switch (ref->policy) {
 			case OBJC_ASSOCIATION_ASSIGN:
@@ -403,15 +683,26 @@ objc_get_associated_object(id object, void *key)
 				result = objc_copy(ref->value);
 				break;
 			case OBJC_ASSOCIATION_COPY:
-				/* This is atomic, need to lock the WLOCK */
-				objc_rw_lock_wlock(&list->lock);
-				result = objc_copy(ref->value);
+				/*
+				 * This is atomic, exclude the setters. The table may have
+				 * grown before the lock was taken, leaving ref in a retired
+				 * copy whose value might have been released already - look
+				 * the key up again.
+				 */
+				objc_rw_lock_rlock(&list->lock);
+				ref = _objc_find_key_reference_in_list(list, key);
+				if (ref != NULL){
+					result = objc_copy(ref->value);
+				}
 				objc_rw_lock_unlock(&list->lock);
 				break;
 			case OBJC_ASSOCIATION_RETAIN:
-				/* This is atomic, need to lock the WLOCK */
-				objc_rw_lock_wlock(&list->lock);
-				result = objc_retain(ref->value);
+				/* Same as above. */
+				objc_rw_lock_rlock(&list->lock);
+				ref = _objc_find_key_reference_in_list(list, key);
+				if (ref != NULL){
+					result = objc_retain(ref->value);
+				}
 				objc_rw_lock_unlock(&list->lock);
 				break;
 			default:
@@ -436,32 +727,6 @@ objc_set_associated_object(id object, void *key, id value,
 	
 	struct reference_list *list = _objc_ref_list_for_object(object, YES);
 	
-	
-	/* WLOCK because we may be actually modifying the linked list */
-	objc_rw_lock_wlock(&list->lock);
-	struct reference *ref = _objc_find_key_reference_in_list(list, key);
-	if (ref == NULL){
-		/* No reference, perhaps need to allocate some */
-		ref = _objc_find_free_reference_in_list(list, YES);
-		objc_assert(ref != NULL,
-					"_objc_reference_create_for_object hasn't"
-					" created reference list for object %p!\n", object);
-	}
-	
-	
-	/*
-	 * See whether either policy is atomic and if not, we can unlock the
-	 * lock. Otherwise, keep it locked and unlock it after all the
-	 * modification of ref.
-	 */
-	BOOL unlocked = NO;
-	BOOL either_policy_atomic = _objc_is_policy_atomic(policy)
-	|| _objc_is_policy_atomic(ref->policy);
-	if (!either_policy_atomic){
-		unlocked = YES;
-		objc_rw_lock_unlock(&list->lock);
-	}
-	
 	switch (policy) {
 		case OBJC_ASSOCIATION_RETAIN_NONATOMIC:
 		case OBJC_ASSOCIATION_RETAIN:
@@ -475,56 +740,31 @@ objc_set_associated_object(id object, void *key, id value,
 			break;
 	}
 	
-	
-	objc_AssociationPolicy old_policy = ref->policy;
-	id old_value = ref->value;
-	
-	ref->key = key;
-	ref->policy = policy;
-	ref->value = value;
-	
-	_objc_dispose_of_object_according_to_policy(old_value, old_policy);
-	
-	
 	/*
-	 * If either of the policies was atomic, the lock is still locked, need
-	 * to unlock it.
+	 * The old value is disposed of only after unlocking. The atomic getters
+	 * retain the value with the lock held, so they are safe either way.
 	 */
-	if (either_policy_atomic){
-		unlocked = YES;
-		objc_rw_lock_unlock(&list->lock);
-	}
-	
-	objc_assert(unlocked,
-				"The lock associated with object %p wasn't unloacked!\n", object);
+	objc_AssociationPolicy old_policy = 0;
+	id old_value = nil;
 	
-}
-
-int
-objc_sync_enter(id obj)
-{
-	if (obj == nil || objc_object_is_small_object(obj)){
-		return 0;
-	}
-	struct reference_list *list = _objc_ref_list_for_object(obj, YES);
 	objc_rw_lock_wlock(&list->lock);
-	return 0;
-}
-
-int
-objc_sync_exit(id obj)
-{
-	if (obj == nil || objc_object_is_small_object(obj)){
-		return 0;
+	struct reference *ref = _objc_find_key_reference_in_list(list, key);
+	if (ref == NULL){
+		if (value != nil){
+			_objc_add_reference_to_list(list, key, value, policy);
+		}
+	}else{
+		old_policy = ref->policy;
+		old_value = ref->value;
+		
+		ref->policy = policy;
+		ref->value = value;
 	}
+	objc_rw_lock_unlock(&list->lock);
 	
-	struct reference_list *list = _objc_ref_list_for_object(obj, NO);
-	if (list == NULL){
-		objc_abort("Unlocking an object that obviously wasn't locked.\n");
-		return 0;
+	if (old_value != nil){
+		_objc_dispose_of_object_according_to_policy(old_value, old_policy);
 	}
-	
-	return objc_rw_lock_unlock(&list->lock);
 }
 
 void
@@ -541,62 +781,40 @@ objc_remove_associated_objects(id object)
 	_objc_remove_associative_lists_for_object(object);
 }
 
-void
-objc_remove_associated_weak_refs(id object)
-{
-	
-	if (objc_object_is_small_object(object)){
-		/* Small objects do not have associated objects */
-		return;
-	}
-	
-	/*
-	 * This function is quite similar to the objc_remove_associated_objects,
-	 * but doesn't actually free any objects, or any of the
-	 * objc_object_ref_list structures.
-	 */
-	
-	struct reference_list *list = _objc_ref_list_for_object(object, NO);
-	if (list == NULL){
-		/* Nothing to do */
-		return;
-	}
-	
-	/*
-	 * Go through the lists and remove all weak refs.
-	 */
-	
-	objc_rw_lock *lock = &list->lock;
-	objc_rw_lock_wlock(lock);
-	
-	while (list != NULL) {
-		for (int i = 0; i < REF_CNT; ++i){
-			struct reference *ref = &list->refs[i];
-			if (ref->policy == OBJC_ASSOCIATION_WEAK_REF){
-				if (ref->value != NULL){
-					*(void**)ref->value = NULL;
-				}
-				ref->value = nil;
-				ref->key = NULL;
-				ref->policy = 0;
-			}
-		}
-		list = list->next;
-	}
-	
-	objc_rw_lock_unlock(lock);
-}
-
 PRIVATE void
 objc_associated_objects_init(void)
 {
-	/*
-	 * No-op at this moment.
-	 */
+#if OBJC_ASSOCIATED_OBJECTS_SIDE_TABLE
+	for (int i = 0; i < OBJC_ASSOC_TABLE_STRIPES; ++i){
+		objc_rw_lock_init(&objc_assoc_table[i].lock, "objc_assoc_table_lock");
+	}
+#endif
 }
 
 PRIVATE void
 objc_associated_objects_destroy(void)
 {
-	objc_associative_pool_free();
+#if OBJC_ASSOCIATED_OBJECTS_SIDE_TABLE
+	/*
+	 * Whatever is left belongs to leaked objects - the memory is freed, but
+	 * the values aren't released.
+	 */
+	for (int i = 0; i < OBJC_ASSOC_TABLE_STRIPES; ++i){
+		struct objc_assoc_stripe *stripe = &objc_assoc_table[i];
+		for (unsigned int j = 0; j < stripe->size; ++j){
+			struct objc_assoc_entry *entry = stripe->buckets[j];
+			while (entry != NULL){
+				struct objc_assoc_entry *next = entry->next;
+				_objc_reference_list_lock_destroy(&entry->list);
+				_objc_free_reference_tables(&entry->list);
+				objc_dealloc(entry, M_REFLIST_TYPE);
+				entry = next;
+			}
+		}
+		if (stripe->buckets != NULL){
+			objc_dealloc(stripe->buckets, M_REFLIST_TYPE);
+		}
+		objc_rw_lock_destroy(&stripe->lock);
+	}
+#endif
 }
@@ -2,6 +2,18 @@
 #ifndef OBJC_ASSOCIATIVE_H
 #define OBJC_ASSOCIATIVE_H
 
+/*
+ * By default, the first association installs a fake class on the object,
+ * which holds the associated objects. When enabled, instances keep their class
+ * and the associated objects live in a global table keyed by the object's
+ * address instead. Classes whose instances were ever added into the table are
+ * marked with has_associated_objects, so that object_dispose only looks
+ * into the table for those.
+ */
+#ifndef OBJC_ASSOCIATED_OBJECTS_SIDE_TABLE
+	#define OBJC_ASSOCIATED_OBJECTS_SIDE_TABLE 0
+#endif
+
 /*
  * Returns an object previously stored by calling objc_set_associated_object()
  * with the same arguments, or nil if none exists.
@@ -23,11 +35,4 @@ void	objc_set_associated_object(id object, void *key, id value,
  */
 void	objc_remove_associated_objects(id object);
 
-/*
- * Removes and zeroes out all weak refs and removes them from the associated
- * objects.
- */
-void	objc_remove_associated_weak_refs(id object);
-
-
 #endif /* OBJC_ASSOCIATIVE_H */
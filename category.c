@@ -8,6 +8,7 @@
 #include "class.h"
 #include "kernobjc/protocol.h"
 #include "private.h"
+#include "method_cache.h"
 
 /*
  * Registers the method list with class.
@@ -47,6 +48,9 @@ _objc_register_methods(Class cls, objc_method_list *list)
 	 */
 	if (classHasDtable(cls)){
 		dtable_add_method_list_to_class(cls, copied_list);
+	}else{
+		/* The method lists of the class may have cached misses. */
+		objc_method_cache_flush();
 	}
 }
 
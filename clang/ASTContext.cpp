@@ -5663,7 +5663,9 @@ TypedefDecl *ASTContext::getObjCIdDecl() const {
 TypedefDecl *ASTContext::getObjCSelDecl() const {
   if (!ObjCSelDecl) {
     QualType SelT;
-    if (getLangOpts().ObjCRuntime.getKind() == ObjCRuntime::KernelObjC){
+    if (getLangOpts().ObjCRuntime.hasLargeSelectors()){
+      SelT = UnsignedIntTy; // Kernel ObjC Runtime with 24-bit selectors
+    }else if (getLangOpts().ObjCRuntime.getKind() == ObjCRuntime::KernelObjC){
       SelT = UnsignedShortTy; // Kernel ObjC Runtime uses uint16_t as SEL
     }else{
       SelT = getPointerType(ObjCBuiltinSelTy);
@@ -1535,6 +1535,9 @@ namespace {
     /// arguments.  Returns the slot for the corresponding method.  Superclass
     /// message lookup rarely changes, so this is a good caching opportunity.
     LazyRuntimeFunction SlotLookupSuperFn;
+    /// The slot lookup function that takes an additional per-call-site cache
+    /// as an argument.  Used for all regular message sends.
+    LazyRuntimeFunction CachedSlotLookupFn;
     /// Specialised function for setting atomic retain properties
     LazyRuntimeFunction SetPropertyAtomic;
     /// Specialised function for setting atomic copy properties
@@ -1552,6 +1555,9 @@ namespace {
     /// Type of an slot structure pointer.  This is returned by the various
     /// lookup functions.
     llvm::Type *SlotTy;
+    /// Type of the per-call-site cache structure.  One zero-initialized
+    /// instance of this is emitted for each message send.
+    llvm::StructType *CallSiteCacheTy;
     /// Type that represents the class structure
     llvm::StructType *ClassTy;
     /// An integer of length one bit
@@ -1610,7 +1616,10 @@ namespace {
     
     /// Creates a selector type
     static llvm::IntegerType *CreateSelectorType(CodeGenModule &cgm) {
-      // The selector is a 16bit (unsigned) int in the kernel runtime
+      // The selector is a 16bit (unsigned) int in the kernel runtime, or
+      // 32bit when the runtime is built with 24-bit selectors
+      if (cgm.getLangOpts().ObjCRuntime.hasLargeSelectors())
+        return llvm::Type::getInt32Ty(cgm.getLLVMContext());
       return llvm::Type::getInt16Ty(cgm.getLLVMContext());
     }
     
@@ -1647,6 +1656,19 @@ namespace {
       // Slot_t objc_msg_lookup_super(struct objc_super*, SEL);
       SlotLookupSuperFn.init(&CGM, "objc_slot_lookup_super", SlotTy,
                              PtrToObjCSuperTy, SelectorTy, NULL);
+      CallSiteCacheTy = llvm::StructType::get(
+                                              IntTy, // seq
+                                              IntTy, // version
+                                              PtrTy, // cls
+                                              SlotTy, // slot
+                                              LongTy, // generation
+                                              NULL);
+      // Slot_t objc_msg_lookup_cached(id *receiver, SEL selector, id sender,
+      //                               struct objc_call_site_cache *cache);
+      CachedSlotLookupFn.init(&CGM, "objc_msg_lookup_cached", SlotTy,
+                              PtrToIdTy, SelectorTy, IdTy,
+                              llvm::PointerType::getUnqual(CallSiteCacheTy),
+                              NULL);
       llvm::Type *VoidTy = llvm::Type::getVoidTy(VMContext);
       // id objc_begin_catch(void *e)
       EnterCatchFn.init(&CGM, "objc_begin_catch", IdTy, PtrTy, NULL);
@@ -3761,7 +3783,7 @@ llvm::Value *CGObjCKern::LookupIMP(CodeGenFunction &CGF,
                                    llvm::MDNode *node,
                                    MessageSendInfo &MSI) {
   CGBuilderTy &Builder = CGF.Builder;
-  llvm::Function *LookupFn = SlotLookupFn;
+  llvm::Function *LookupFn = CachedSlotLookupFn;
   
   // Store the receiver on the stack so that we can reload it later
   llvm::Value *ReceiverPtr = CGF.CreateTempAlloca(Receiver->getType());
@@ -3775,15 +3797,25 @@ llvm::Value *CGObjCKern::LookupIMP(CodeGenFunction &CGF,
     self = llvm::ConstantPointerNull::get(IdTy);
   }
   
+  // Each call site gets its own cache, which the runtime fills in on the
+  // first send and validates against the slot version afterwards.
+  llvm::GlobalVariable *Cache =
+    new llvm::GlobalVariable(TheModule, CallSiteCacheTy, false,
+                             llvm::GlobalValue::PrivateLinkage,
+                             llvm::Constant::getNullValue(CallSiteCacheTy),
+                             ".objc_call_site_cache");
+  
   // The lookup function is guaranteed not to capture the receiver pointer.
   LookupFn->setDoesNotCapture(1);
   
   llvm::Value *args[] = {
     EnforceType(Builder, ReceiverPtr, PtrToIdTy),
     EnforceType(Builder, cmd, SelectorTy),
-    EnforceType(Builder, self, IdTy) };
+    EnforceType(Builder, self, IdTy),
+    Cache };
+  // Not marked as only reading memory - the runtime writes into the cache, and
+  // the optimizer must not turn it into a constant.
   llvm::CallSite slot = CGF.EmitRuntimeCallOrInvoke(LookupFn, args);
-  slot.setOnlyReadsMemory();
   slot->setMetadata(msgSendMDKind, node);
   
   // Load the imp from the slot - the IMP is at index 2 in the kernel RT
@@ -3940,7 +3972,7 @@ llvm::StructType *CGObjCKern::GetMethodDescriptionStructureType(void) {
   return llvm::StructType::get(
                                PtrToInt8Ty, // Name
                                PtrToInt8Ty, // Types
-                               SelectorTy, // The actual 16-bit selector
+                               SelectorTy, // The actual selector
                                NULL);
 }
 
@@ -4425,6 +4457,18 @@ void CGObjCKern::GenerateClass(const ObjCImplementationDecl *OID) {
   ClassTable[ClassName] = ClassPair(ClassStruct, MetaClassStruct);
 }
 
+/// Hashes the selector name the same way the runtime's objc_hash_string()
+/// does, so that the runtime can use the hash from the precomputed selector
+/// table directly.
+static uint32_t KernSelectorHash(StringRef Name) {
+  uint32_t Hash = 0;
+  for (StringRef::iterator i = Name.begin(), e = Name.end(); i != e; ++i) {
+    int32_t C = (signed char)*i;
+    Hash = C + (Hash << 6) + (Hash << 16) - Hash;
+  }
+  return Hash;
+}
+
 llvm::Function *CGObjCKern::ModuleInitFunction(){
   // Only emit an ObjC load function if no Objective-C stuff has been called
   if (Classes.empty() && Categories.empty() && ConstantStrings.empty() &&
@@ -4435,15 +4479,16 @@ llvm::Function *CGObjCKern::ModuleInitFunction(){
   
   llvm::StructType *ModuleStructTy;
   llvm::StructType *SymbolTableStructTy;
-  llvm::StructType *SelRefStructTy;
+  llvm::StructType *PrecomputedSelStructTy;
   
   llvm::PointerType *PtrToSelectorTy = llvm::PointerType::getUnqual(SelectorTy);
   llvm::PointerType *PtrToSymbolTableStructTy;
   
-  SelRefStructTy = llvm::StructType::get(PtrToInt8Ty, // Selector name
-                                         PtrToInt8Ty, // Selector types
-                                         PtrToSelectorTy, // Pointer to static SEL
-                                         NULL);
+  PrecomputedSelStructTy = llvm::StructType::get(PtrToInt8Ty, // Selector name
+                                                 PtrToInt8Ty, // Selector types
+                                                 PtrToSelectorTy, // Pointer to static SEL
+                                                 Int32Ty, // Hash of the name
+                                                 NULL);
   SymbolTableStructTy = llvm::StructType::get(IntTy, // Number of selector refs
                                               PtrToInt8Ty, // Sel refs
                                               Int16Ty, // Class count
@@ -4452,6 +4497,8 @@ llvm::Function *CGObjCKern::ModuleInitFunction(){
                                               PtrToInt8Ty, // Categories list
                                               Int16Ty, // Protocol count
                                               PtrToInt8Ty, // Protocol list
+                                              IntTy, // Selector table count
+                                              PtrToInt8Ty, // Selector table
                                               NULL
                                               );
   PtrToSymbolTableStructTy = llvm::PointerType::getUnqual(SymbolTableStructTy);
@@ -4462,7 +4509,9 @@ llvm::Function *CGObjCKern::ModuleInitFunction(){
   
   std::vector<llvm::Constant*> Elements;
   
-  // Selectors.
+  // Selectors. The SelectorTable is keyed by name and the kernel runtime only
+  // allows one type per name (checked below), so each selector is emitted
+  // exactly once, together with the hash of its name.
   std::vector<llvm::Constant*> Selectors;
   for (SelectorMap::iterator iter = SelectorTable.begin(),
        iterEnd = SelectorTable.end(); iter != iterEnd ; ++iter) {
@@ -4495,8 +4544,11 @@ llvm::Function *CGObjCKern::ModuleInitFunction(){
       // Second is the global variable - we supply a pointer to it to the
       // runtime which then fixes it
       Elements.push_back(i->second);
+      Elements.push_back(llvm::ConstantInt::get(Int32Ty,
+                                                KernSelectorHash(Name)));
       
-      Selectors.push_back(llvm::ConstantStruct::get(SelRefStructTy, Elements));
+      Selectors.push_back(llvm::ConstantStruct::get(PrecomputedSelStructTy,
+                                                    Elements));
       
       Elements.clear();
     }
@@ -4504,12 +4556,9 @@ llvm::Function *CGObjCKern::ModuleInitFunction(){
   
   unsigned SelectorCount = Selectors.size();
   
-  // Selectors
-  Elements.push_back(llvm::ConstantInt::get(IntTy, SelectorCount));
-  llvm::Constant *SelectorList = MakeGlobalArray(SelRefStructTy, Selectors,
-                                                 ".objc_selector_list");
-  Elements.push_back(llvm::ConstantExpr::getBitCast(SelectorList,
-                                                    PtrToInt8Ty));
+  // Selector references - all selectors are in the selector table instead.
+  Elements.push_back(llvm::ConstantInt::get(IntTy, 0));
+  Elements.push_back(llvm::ConstantPointerNull::get(PtrToInt8Ty));
   
   Elements.push_back(llvm::ConstantInt::get(Int16Ty, Classes.size())); // Classes
   llvm::Constant *ClassList = MakeGlobalArray(IdTy, Classes,
@@ -4533,13 +4582,25 @@ llvm::Function *CGObjCKern::ModuleInitFunction(){
   llvm::Constant *ProtocolList = MakeGlobalArray(IdTy, Protocols);
   Elements.push_back(llvm::ConstantExpr::getBitCast(ProtocolList, PtrToInt8Ty));
   
+  // Precomputed selector table
+  Elements.push_back(llvm::ConstantInt::get(IntTy, SelectorCount));
+  llvm::Constant *SelectorList = MakeGlobalArray(PrecomputedSelStructTy,
+                                                 Selectors,
+                                                 ".objc_selector_table");
+  Elements.push_back(llvm::ConstantExpr::getBitCast(SelectorList,
+                                                    PtrToInt8Ty));
+  
   llvm::Constant *SymbolTable = MakeGlobal(SymbolTableStructTy, Elements);
   Elements.clear();
   
   // Now we need to create the loader module
   Elements.push_back(MakeConstantString(TheModule.getModuleIdentifier())); // Name
   Elements.push_back(SymbolTable);
-  Elements.push_back(llvm::ConstantInt::get(IntTy, (int)0x301));
+  // ABI version, flagged when the selectors are 24-bit
+  int Version = 0x302;
+  if (CGM.getLangOpts().ObjCRuntime.hasLargeSelectors())
+    Version |= 0x10000;
+  Elements.push_back(llvm::ConstantInt::get(IntTy, Version));
   
   llvm::GlobalVariable *ModuleStruct = MakeGlobal(ModuleStructTy,
                                                   Elements,
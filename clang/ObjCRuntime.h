@@ -303,6 +303,14 @@ public:
     }
   }
 
+  /// \brief Does this runtime use 24-bit selectors (stored in 32 bits)?
+  /// The kernel runtime uses 16-bit selectors unless version 2 or newer
+  /// (-fobjc-runtime=kernel-runtime-2) is requested, which must match
+  /// a run-time built with OBJC_LARGE_SELECTORS.
+  bool hasLargeSelectors() const {
+    return getKind() == KernelObjC && getVersion() >= VersionTuple(2);
+  }
+
   /// \brief Try to parse an Objective-C runtime specification from the given
   /// string.
   ///
@@ -13,6 +13,7 @@
 #include "sarray2.h"
 #include "runtime.h"
 #include "class.h"
+#include "associative.h"
 #include "private.h"
 
 /*
@@ -456,6 +457,19 @@ object_dispose(id obj)
 	}
 	
 	call_cxx_destruct(obj);
+	
+	/*
+	 * objc_release() has cleared the weak references already, but objects
+	 * released by -release (MRR or custom ARR) only get here.
+	 */
+	objc_delete_weak_refs(obj);
+	
+#if OBJC_ASSOCIATED_OBJECTS_SIDE_TABLE
+	if (objc_object_get_nonfake_class_inline(obj)->flags.has_associated_objects){
+		objc_remove_associated_objects(obj);
+	}
+#endif
+	
 	objc_dealloc(obj, M_OBJECT_TYPE);
 }
 
@@ -78,4 +78,28 @@ objc_object_get_nonfake_class_inline(id obj)
 	return cl;
 }
 
+/*
+ * Sets one of the objc_class_flags bits to value. The flags share a single
+ * byte, so concurrently written flags would overwrite each other without the
+ * compare-and-swap. Hence all the flags of a class that other threads may
+ * already see need to be written this way - only classes still being built
+ * can have their flags assigned directly.
+ */
+#define OBJC_CLASS_WRITE_FLAG(cls, flag, value)								\
+	do {																	\
+		union {																\
+			objc_class_flags flags;											\
+			uint8_t bits;													\
+		} old_flags, new_flags;												\
+		do {																\
+			old_flags.flags = (cls)->flags;									\
+			new_flags = old_flags;											\
+			new_flags.flags.flag = (value);									\
+		} while (!__sync_bool_compare_and_swap(								\
+					(volatile uint8_t *)&(cls)->flags,						\
+					old_flags.bits, new_flags.bits));						\
+	} while (0)
+
+#define OBJC_CLASS_SET_FLAG(cls, flag) OBJC_CLASS_WRITE_FLAG(cls, flag, YES)
+
 #endif /* !OBJC_CLASS_H_ */
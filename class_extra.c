@@ -16,7 +16,7 @@
  * Therefore a spinlock is used instead of using a RW lock or mutex, since
  * the contention is expected to be minimal if any.
  */
-volatile int class_extra_spinlock;
+static struct objc_spinlock class_extra_spinlock;
 
 struct objc_class_extra {
 	struct objc_class_extra		*next;
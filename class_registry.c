@@ -11,6 +11,7 @@
 #include "private.h"
 #include "init.h"
 #include "class_extra.h"
+#include "method_cache.h"
 
 /*
  * The initial capacities for the hash tables.
@@ -535,6 +536,10 @@ _objc_deallocate_class_fields(Class cls)
 	free_dtable((dtable_t*)&cls->dtable);
 	free_dtable((dtable_t*)&meta->dtable);
 	
+	/* The memory may get reused for another class. */
+	__sync_fetch_and_add(&objc_dtable_generation, 1);
+	objc_method_cache_flush();
+	
 	if (cls->extra_space != NULL) {
 		objc_class_extra_destroy_for_class(cls);
 	}
@@ -689,8 +694,8 @@ objc_class_resolve(Class cl)
 	
 	_objc_class_remove_from_unresolved_list(cl);
 	
-	cl->flags.resolved = YES;
-	cl->isa->flags.resolved = YES;
+	OBJC_CLASS_SET_FLAG(cl, resolved);
+	OBJC_CLASS_SET_FLAG(cl->isa, resolved);
 	
 	_objc_insert_class_into_class_tree(cl);
 	
@@ -701,6 +706,11 @@ objc_class_resolve(Class cl)
 	return YES;
 }
 
+/*
+ * Resolves all the unresolved classes in a single pass. An explicit stack
+ * resolves the superclasses of each class first, so the recursion of
+ * objc_class_resolve into an unresolved superclass never gets deep.
+ */
 PRIVATE void
 objc_class_resolve_links(void)
 {
@@ -708,22 +718,50 @@ objc_class_resolve_links(void)
 	
 	objc_debug_log("resolving class links\n");
 	
+	unsigned int count = 0;
+	for (Class cl = unresolved_classes; cl != Nil;
+		 cl = cl->unresolved_class_next){
+		++count;
+	}
+	if (count == 0){
+		return;
+	}
+	
+	/* Superclasses of unresolved classes are unresolved classes as well. */
+	Class *stack = objc_alloc(count * sizeof(Class), M_CLASS_TYPE);
+	
 	Class cl = unresolved_classes;
-	BOOL resolved_class;
-	do {
-		resolved_class = NO;
-		while (cl != Nil) {
-			/* Need to remember the next before resolving */
-			Class next = cl->unresolved_class_next;
-			
-			objc_class_resolve(cl);
-			resolved_class |= cl->flags.resolved;
-			
-			cl = next;
+	while (cl != Nil) {
+		/* Need to remember the next before resolving */
+		Class next = cl->unresolved_class_next;
+		
+		unsigned int depth = 0;
+		for (Class c = cl; c != Nil && !c->flags.resolved;
+			 c = c->super_class){
+			if (depth == count){
+				/* Shouldn't happen, but resolve it recursively then. */
+				break;
+			}
+			stack[depth++] = c;
 		}
 		
-		cl = unresolved_classes;
-	} while (resolved_class);
+		while (depth > 0){
+			objc_class_resolve(stack[--depth]);
+		}
+		objc_class_resolve(cl);
+		
+		/*
+		 * Resolving sends +load messages, which may have resolved the next
+		 * class already, so it may no longer be on the list.
+		 */
+		if (next != Nil && next->flags.resolved){
+			next = cl->flags.resolved ? unresolved_classes
+									  : cl->unresolved_class_next;
+		}
+		cl = next;
+	}
+	
+	objc_dealloc(stack, M_CLASS_TYPE);
 }
 
 PRIVATE void
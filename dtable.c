@@ -14,6 +14,7 @@
 #include "private.h"
 #include "init.h"
 #include "exception.h"
+#include "method_cache.h"
 
 PRIVATE dtable_t uninstalled_dtable;
 
@@ -21,6 +22,11 @@ PRIVATE dtable_t uninstalled_dtable;
 PRIVATE InitializingDtable *temporary_dtables;
 /* Lock used to protect the temporary dtables list. */
 PRIVATE objc_rw_lock initialize_lock;
+/* Lock-free index of the temporary dtables list.  See dtable.h. */
+PRIVATE volatile TemporaryDtableEntry
+						temporary_dtable_table[TEMPORARY_DTABLE_TABLE_SIZE];
+/* Number of temporary dtables that didn't fit into the table. */
+PRIVATE volatile unsigned int temporary_dtables_overflow;
 
 /*
  * Returns YES if the class implements a method for the specified selector, NO
@@ -39,7 +45,7 @@ static BOOL ownsMethod(Class cls, SEL sel)
 static inline BOOL _objc_check_class_for_custom_arr_method(Class cls, SEL sel){
 	struct objc_slot *slot = objc_get_slot(cls, sel);
 	if (NULL != slot && slot->owner == cls){
-		cls->flags.has_custom_arr = YES;
+		OBJC_CLASS_SET_FLAG(cls, has_custom_arr);
 		return YES;
 	}
 	return NO;
@@ -66,7 +72,7 @@ static void checkARCAccessors(Class cls)
 			return;
 		}
 	}
-	cls->flags.has_custom_arr = NO;
+	OBJC_CLASS_WRITE_FLAG(cls, has_custom_arr, NO);
 }
 
 static void collectMethodsForMethodListToSparseArray(
@@ -119,8 +125,14 @@ static BOOL installMethodInDtable(Class class,
 	struct objc_slot *slot = SparseArrayLookup(dtable, sel_id);
 	if (NULL != slot)
 	{
-		// If this method is the one already installed, pretend to install it again.
-		if (slot->implementation == method->implementation) { return NO; }
+		// If this method is the one already installed, pretend to install it
+		// again.  Compact dtables see inherited methods through the
+		// superclass's dtable, so report those as installed so that the
+		// subclasses get them as well.
+		if (slot->implementation == method->implementation)
+		{
+			return (SparseArrayIsCompact(dtable) && class != owner);
+		}
 
 		// If the existing slot is for this class, we can just replace the
 		// implementation.  We don't need to bump the version; this operation
@@ -149,8 +161,25 @@ static BOOL installMethodInDtable(Class class,
 		}
 	}
 	struct objc_slot *oldSlot = slot;
-	slot = objc_slot_create_for_method_in_class((void*)method, owner);
-	SparseArrayInsert(dtable, sel_id, slot);
+	if (class == owner)
+	{
+		slot = objc_slot_create_for_method_in_class((void*)method, owner);
+		SparseArrayInsert(dtable, sel_id, slot);
+	}
+	else
+	{
+		// The method is inherited, so the superclass has already got a slot
+		// for it.  Share the slot (and the leaf of the dtable, if possible)
+		// rather than allocating a new one for each subclass.
+		SparseArray *super_dtable = dtable_for_class(class->super_class);
+		slot = SparseArrayLookup(super_dtable, sel_id);
+		if (NULL == slot || slot->owner != owner ||
+			slot->implementation != method->implementation)
+		{
+			slot = objc_slot_create_for_method_in_class((void*)method, owner);
+		}
+		SparseArrayInsertShared(dtable, super_dtable, sel_id, slot);
+	}
 	
 	// Invalidate the old slot, if there is one.
 	if (NULL != oldSlot)
@@ -160,24 +189,37 @@ static BOOL installMethodInDtable(Class class,
 	return YES;
 }
 
-static void installMethodsInClass(Class cls,
-                                  Class owner,
-                                  SparseArray *methods,
-                                  BOOL replaceExisting)
+/*
+ * Installs the methods into the class's dtable and returns the methods that
+ * were actually installed.  If copyOnWrite is YES, the methods array is left
+ * intact and a copy is returned when some methods weren't installed.  The
+ * caller owns the returned array if it differs from methods.
+ */
+static SparseArray *installMethodsInClass(Class cls,
+                                          Class owner,
+                                          SparseArray *methods,
+                                          BOOL replaceExisting,
+                                          BOOL copyOnWrite)
 {
 	SparseArray *dtable = dtable_for_class(cls);
 	objc_assert(uninstalled_dtable != dtable, "");
 
-	uint16_t idx = 0;
+	SparseArray *installed = methods;
+	SparseArrayIndex idx = 0;
 	struct objc_method *m;
 	while ((m = SparseArrayNext(methods, &idx)))
 	{
 		if (!installMethodInDtable(cls, owner, dtable, m, replaceExisting))
 		{
+			if (copyOnWrite && installed == methods)
+			{
+				installed = SparseArrayCopy(methods);
+			}
 			// Remove this method from the list, if it wasn't actually installed
-			SparseArrayInsert(methods, idx, 0);
+			SparseArrayInsert(installed, idx, 0);
 		}
 	}
+	return installed;
 }
 
 static void mergeMethodsFromSuperclass(Class super, Class cls, SparseArray *methods)
@@ -189,15 +231,19 @@ static void mergeMethodsFromSuperclass(Class super, Class cls, SparseArray *meth
 		// initialized yet
 		if (!classHasDtable(subclass)) { continue; }
 
-		// Create a new (copy-on-write) array to pass down to children
-		SparseArray *newMethods = SparseArrayCopy(methods);
 		// Install all of these methods except ones that are overridden in the
 		// subclass.  All of the methods that we are updating were added in a
 		// superclass, so we don't replace versions registered to the subclass.
-		installMethodsInClass(subclass, super, newMethods, YES);
+		// The array passed down to children is only copied if the subclass
+		// overrides some of the methods.
+		SparseArray *newMethods = installMethodsInClass(subclass, super,
+		                                                methods, YES, YES);
 		// Recursively add the methods to the subclass's subclasses.
 		mergeMethodsFromSuperclass(super, subclass, newMethods);
-		SparseArrayDestroy(&newMethods);
+		if (newMethods != methods)
+		{
+			SparseArrayDestroy(&newMethods);
+		}
 	}
 }
 
@@ -206,11 +252,12 @@ static inline void _add_method_list_to_class(Class cls, objc_method_list *list,
 	OBJC_LOCK_RUNTIME_FOR_SCOPE();
 	SparseArray *methods = SparseArrayNew();
 	collectMethodsForMethodListToSparseArray(list, methods, follow);
-	installMethodsInClass(cls, cls, methods, YES);
+	installMethodsInClass(cls, cls, methods, YES, NO);
 	// Methods now contains only the new methods for this class.
 	mergeMethodsFromSuperclass(cls, cls, methods);
 	SparseArrayDestroy(&methods);
 	checkARCAccessors(cls);
+	objc_method_cache_flush();
 }
 
 
@@ -271,7 +318,17 @@ static dtable_t create_dtable_for_class(Class class, dtable_t root_dtable)
 				objc_abort("Creating a dtable for a class that isn't the class\n");
 			}
 		}
-		dtable = SparseArrayCopy(super_dtable);
+		// The fake classes of associated objects only hold .cxx_destruct, so
+		// they get a compact dtable that defers to the real class.  Other
+		// classes keep a copy, since objc_msgSend only handles those inline.
+		if (class->flags.fake)
+		{
+			dtable = SparseArrayNewCompact(super_dtable);
+		}
+		else
+		{
+			dtable = SparseArrayCopy(super_dtable);
+		}
 	}
 
 	// When constructing the initial dtable for a class, we iterate along the
@@ -310,6 +367,74 @@ __attribute__((unused)) static void objc_release_object_lock(id *x)
 	objc_sync_exit(*x);
 }
 
+/*
+ * Adds the temporary dtable to the lock-free table.  Must be called with
+ * initialize_lock held.
+ */
+static void temporary_dtable_table_insert(Class cls, dtable_t dtable)
+{
+	unsigned int index = temporary_dtable_hash(cls);
+	for (unsigned int i = 0 ; i < TEMPORARY_DTABLE_TABLE_SIZE ; i++)
+	{
+		volatile TemporaryDtableEntry *entry =
+			&temporary_dtable_table[(index + i) & TEMPORARY_DTABLE_TABLE_MASK];
+		if (Nil == entry->class || TEMPORARY_DTABLE_TOMBSTONE == entry->class)
+		{
+			entry->dtable = dtable;
+			// Readers must never see the class with a stale dtable.
+			__sync_synchronize();
+			entry->class = cls;
+			return;
+		}
+	}
+	// The table is full, the readers will need to walk the list.
+	__sync_fetch_and_add(&temporary_dtables_overflow, 1);
+}
+
+/*
+ * Removes the temporary dtable from the lock-free table.  Must be called with
+ * initialize_lock held, after the real dtable has been installed.
+ */
+static void temporary_dtable_table_remove(Class cls)
+{
+	unsigned int index = temporary_dtable_hash(cls);
+	for (unsigned int i = 0 ; i < TEMPORARY_DTABLE_TABLE_SIZE ; i++)
+	{
+		unsigned int position = (index + i) & TEMPORARY_DTABLE_TABLE_MASK;
+		volatile TemporaryDtableEntry *entry = &temporary_dtable_table[position];
+		if (Nil == entry->class)
+		{
+			break;
+		}
+		if (entry->class == cls)
+		{
+			// If nothing follows in the probe sequence, the entry (and any
+			// tombstones before it) can be freed for good.
+			volatile TemporaryDtableEntry *next =
+				&temporary_dtable_table[(position + 1) & TEMPORARY_DTABLE_TABLE_MASK];
+			if (Nil != next->class)
+			{
+				entry->class = TEMPORARY_DTABLE_TOMBSTONE;
+				return;
+			}
+			entry->class = Nil;
+			while (1)
+			{
+				position = (position - 1) & TEMPORARY_DTABLE_TABLE_MASK;
+				entry = &temporary_dtable_table[position];
+				if (TEMPORARY_DTABLE_TOMBSTONE != entry->class)
+				{
+					break;
+				}
+				entry->class = Nil;
+			}
+			return;
+		}
+	}
+	// Not in the table, so it must have overflowed.
+	__sync_fetch_and_sub(&temporary_dtables_overflow, 1);
+}
+
 /*
  * Remove a buffer from an entry in the initializing dtables list.  This is
  * called as a cleanup to ensure that it runs even if +initialize throws an
@@ -322,6 +447,11 @@ static void remove_dtable(InitializingDtable* meta_buffer)
 	// Install the dtable:
 	meta_buffer->class->dtable = meta_buffer->dtable;
 	buffer->class->dtable = buffer->dtable;
+	// Lock-free readers check the installed dtable after failing to find the
+	// temporary one, so it must be visible before the entries are removed.
+	__sync_synchronize();
+	temporary_dtable_table_remove(meta_buffer->class);
+	temporary_dtable_table_remove(buffer->class);
 	// Remove the look-aside buffer entry.
 	if (temporary_dtables == meta_buffer)
 	{
@@ -411,8 +541,8 @@ PRIVATE void objc_send_initialize(id object)
 
 	// Set the initialized flag on both this class and its metaclass, to make
 	// sure that +initialize is only ever sent once.
-	class->flags.initialized = YES;
-	meta->flags.initialized = YES;
+	OBJC_CLASS_SET_FLAG(class, initialized);
+	OBJC_CLASS_SET_FLAG(meta, initialized);
 
 	dtable_t class_dtable = create_dtable_for_class(class, uninstalled_dtable);
 	dtable_t dtable = skipMeta ? 0 : create_dtable_for_class(meta, class_dtable);
@@ -461,6 +591,8 @@ PRIVATE void objc_send_initialize(id object)
 	InitializingDtable buffer = { class, class_dtable, temporary_dtables };
 	InitializingDtable meta_buffer = { meta, dtable, &buffer };
 	temporary_dtables = &meta_buffer;
+	temporary_dtable_table_insert(class, class_dtable);
+	temporary_dtable_table_insert(meta, dtable);
 	// We now release the initialize lock.  We'll reacquire it later when we do
 	// the cleanup, but at this point we allow other threads to get the
 	// temporary dtable and call +initialize in other threads.
@@ -35,6 +35,91 @@ static inline int classHasInstalledDtable(struct objc_class *cls)
 	return (cls->dtable != uninstalled_dtable);
 }
 
+/*
+ * The temporary dtables are also indexed by an open-addressed hash table so
+ * that dtable_for_class can find them without taking initialize_lock.  The
+ * table is only modified with initialize_lock held.  Entries get the class set
+ * after the dtable, and removed entries are marked with a tombstone so that
+ * the probe sequences of other entries stay intact.  If the table is full, the
+ * dtable is only put on the list and temporary_dtables_overflow is
+ * incremented, which makes readers fall back to walking the list under the
+ * lock.
+ */
+#define TEMPORARY_DTABLE_TABLE_SIZE 64
+#define TEMPORARY_DTABLE_TABLE_MASK (TEMPORARY_DTABLE_TABLE_SIZE - 1)
+#define TEMPORARY_DTABLE_TOMBSTONE ((Class)1)
+
+typedef struct
+{
+	Class class;
+	dtable_t dtable;
+} TemporaryDtableEntry;
+
+PRIVATE extern volatile TemporaryDtableEntry
+						temporary_dtable_table[TEMPORARY_DTABLE_TABLE_SIZE];
+PRIVATE extern volatile unsigned int temporary_dtables_overflow;
+
+static inline unsigned int temporary_dtable_hash(Class cls)
+{
+	return (unsigned int)(((uintptr_t)cls >> 4) & TEMPORARY_DTABLE_TABLE_MASK);
+}
+
+/*
+ * Looks up the temporary dtable without taking any locks.  Returns
+ * uninstalled_dtable if there is no temporary dtable for the class in the
+ * hash table.
+ */
+static inline dtable_t temporary_dtable_lookup(Class cls)
+{
+	unsigned int index = temporary_dtable_hash(cls);
+	for (unsigned int i = 0 ; i < TEMPORARY_DTABLE_TABLE_SIZE ; i++)
+	{
+		volatile TemporaryDtableEntry *entry =
+			&temporary_dtable_table[(index + i) & TEMPORARY_DTABLE_TABLE_MASK];
+		Class entryClass = entry->class;
+		if (Nil == entryClass)
+		{
+			break;
+		}
+		if (entryClass == cls)
+		{
+			__sync_synchronize();
+			dtable_t dtable = entry->dtable;
+			__sync_synchronize();
+			// Make sure the entry wasn't reused while we were reading it.
+			if (entry->class == cls)
+			{
+				return dtable;
+			}
+			break;
+		}
+	}
+	return uninstalled_dtable;
+}
+
+/*
+ * Walks the list of temporary dtables.  Only used when the hash table
+ * overflowed.
+ */
+static inline dtable_t temporary_dtable_lookup_locked(Class cls)
+{
+	OBJC_LOCK_FOR_SCOPE(&initialize_lock);
+	if (classHasInstalledDtable(cls))
+	{
+		return cls->dtable;
+	}
+	for (InitializingDtable *buffer = temporary_dtables ; NULL != buffer ;
+		 buffer = buffer->next)
+	{
+		if (buffer->class == cls)
+		{
+			return buffer->dtable;
+		}
+	}
+	return uninstalled_dtable;
+}
+
+
 /*
  * Returns the dtable for a given class.  If we are currently in an +initialize
  * method then this will block if called from a thread other than the one
@@ -47,35 +132,27 @@ static inline dtable_t dtable_for_class(Class cls)
 		return cls->dtable;
 	}
 
-	dtable_t dtable = uninstalled_dtable;
-
+	dtable_t dtable = temporary_dtable_lookup(cls);
+	if (dtable == uninstalled_dtable)
 	{
-		OBJC_LOCK_FOR_SCOPE(&initialize_lock);
-		if (classHasInstalledDtable(cls))
+		if (UNLIKELY(0 != temporary_dtables_overflow))
 		{
-			return cls->dtable;
+			dtable = temporary_dtable_lookup_locked(cls);
 		}
-		/* This is a linear search, and so, in theory, could be very slow.  It
-		 * is O(n) where n is the number of +initialize methods on the stack.
-		 * In practice, this is a very small number.  Profiling with GNUstep
-		 * showed that this peaks at 8. */
-		InitializingDtable *buffer = temporary_dtables;
-		while (NULL != buffer)
+		// The dtable is installed before the temporary one is removed, so if
+		// +initialize finished while we were looking, we'll see it now.
+		__sync_synchronize();
+		if (classHasInstalledDtable(cls))
 		{
-			if (buffer->class == cls)
-			{
-				dtable = buffer->dtable;
-				break;
-			}
-			buffer = buffer->next;
+			return cls->dtable;
 		}
 	}
 
 	if (dtable != uninstalled_dtable)
 	{
 		// Make sure that we block if +initialize is still running.  We do this
-		// after we've released the initialize lock, so that the real dtable
-		// can be installed.  This acquires / releases a recursive mutex, so if
+		// without holding the initialize lock, so that the real dtable can be
+		// installed.  This acquires / releases a recursive mutex, so if
 		// this mutex is already held by this thread then this will proceed
 		// immediately.  If it's held by another thread (i.e. the one running
 		// +initialize) then we block here until it's run.  We don't need to do
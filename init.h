@@ -14,6 +14,15 @@ PRIVATE void	objc_class_init(void);
 PRIVATE void	objc_dispatch_tables_destroy(void);
 PRIVATE void	objc_dispatch_tables_init(void);
 
+PRIVATE void	objc_retain_count_destroy(void);
+PRIVATE void	objc_retain_count_init(void);
+
+PRIVATE void	objc_weak_table_destroy(void);
+PRIVATE void	objc_weak_table_init(void);
+
+PRIVATE void	objc_sync_destroy(void);
+PRIVATE void	objc_sync_init(void);
+
 PRIVATE void	objc_protocol_destroy(void);
 PRIVATE void	objc_protocol_init(void);
 
@@ -10,7 +10,7 @@ __attribute__((objc_root_class))
 #endif
 @interface KKObject {
 	id isa;
-	int __retain_count;
+	objc_retain_count __retain_count;
 }
 
 +(id)alloc;
@@ -6,8 +6,54 @@
 void	objc_autoreleasePoolPop(void *pool);
 void	*objc_autoreleasePoolPush(void);
 
+/*
+ * Autorelease pressure. The pool depth is the number of pools pushed and not
+ * yet popped, the peak depth is the maximum depth reached.
+ */
+struct objc_autorelease_statistics {
+	/* Objects autoreleased and not yet released by a pool pop. */
+	unsigned long objects_pending;
+	
+	/* Objects autoreleased in total. */
+	unsigned long objects_autoreleased;
+	
+	/*
+	 * Objects returned by objc_autoreleaseReturnValue() and taken over by
+	 * objc_retainAutoreleasedReturnValue() without being autoreleased.
+	 */
+	unsigned long objects_handed_over;
+	
+	/*
+	 * Autorelease pool pages that had to be allocated and pages that were
+	 * taken from the per-thread cache instead.
+	 */
+	unsigned long pages_allocated;
+	unsigned long pages_reused;
+	
+	unsigned int pool_depth;
+	unsigned int pool_peak_depth;
+	
+	unsigned int thread_count;
+};
+
+/*
+ * Fills the stats with the counters of the current thread.
+ */
+void	objc_autorelease_get_thread_statistics(
+				struct objc_autorelease_statistics *stats);
+
+/*
+ * Fills the stats with the counters summed over all threads. The depth is
+ * summed as well, the peak depth is the maximum of all threads' peaks. The
+ * totals of autoreleased and handed over objects and of pool pages include
+ * threads that already exited.
+ */
+void	objc_autorelease_get_statistics(
+				struct objc_autorelease_statistics *stats);
+
 /* ARR */
 id	objc_autorelease(id obj);
+id	objc_autoreleaseReturnValue(id obj);
 void	objc_copyWeak(id *dest, id *src);
 void	objc_delete_weak_refs(id obj);
 void	objc_destroyWeak(id *obj);
@@ -18,6 +64,8 @@ void	objc_moveWeak(id *dest, id *src);
 void	objc_release(id obj);
 id	objc_retain(id obj);
 id	objc_retainAutorelease(id obj);
+id	objc_retainAutoreleaseReturnValue(id obj);
+id	objc_retainAutoreleasedReturnValue(id obj);
 id	objc_storeStrong(id *addr, id value);
 id	objc_storeWeak(id *addr, id value);
 
@@ -2,6 +2,26 @@
 #ifndef OBJC_LOADER_H
 #define OBJC_LOADER_H
 
+/*
+ * Time spent in each phase of loading, in nanoseconds, accumulated over all
+ * loaded kernel modules.
+ */
+struct objc_loader_statistics {
+	uint64_t selectors;
+	uint64_t classes;
+	uint64_t categories;
+	uint64_t protocols;
+	uint64_t resolving;
+	
+	unsigned int module_count;
+	unsigned int class_count;
+};
+
+/*
+ * Fills the stats with the loader's counters.
+ */
+void	objc_loader_get_statistics(struct objc_loader_statistics *stats);
+
 #ifdef _KERNEL
 
 /*
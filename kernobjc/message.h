@@ -11,6 +11,14 @@
  */
 
 id		objc_msgSend(id receiver, SEL selector, ...);
+void	objc_msgSend_stret(id receiver, SEL selector, ...);
+
+/*
+ * Same as objc_msgSend, but the method lookup starts in super->class and the
+ * message is sent to super->receiver.
+ */
+id		objc_msgSendSuper(struct objc_super *super, SEL selector, ...);
+void	objc_msgSendSuper_stret(struct objc_super *super, SEL selector, ...);
 
 
 #endif /* !LIBKERNOBJC_MESSAGE_H */
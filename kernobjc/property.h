@@ -28,6 +28,28 @@ void objc_setPropertyStruct(void *dest,
                             BOOL atomic,
                             BOOL strong);
 
+/*
+ * Contention of the property spinlocks, which guard atomic struct properties
+ * and the creation of classes for associated objects. Only the acquisitions
+ * that found the lock held are counted.
+ */
+struct objc_spinlock_statistics {
+	/* Acquisitions that had to wait for the lock. */
+	unsigned long contended;
+	
+	/* Backoff rounds spent waiting. */
+	unsigned long spins;
+	
+	/* Times the waiting thread gave up the CPU. */
+	unsigned long yields;
+};
+
+/*
+ * Fills the stats with the counters summed over all the spinlocks. The sums
+ * are racy, but each counter only ever grows.
+ */
+void objc_spinlock_get_statistics(struct objc_spinlock_statistics *stats);
+
 // DEPRECATED
 void objc_copyPropertyStruct(void *dest,
                              void *src,
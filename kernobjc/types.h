@@ -45,8 +45,44 @@ typedef struct objc_property_list_struct objc_property_list;
 typedef struct objc_ivar_list_struct objc_ivar_list;
 typedef struct objc_category_list_struct objc_category_list;
 
-/* A definition of a SEL. */
+/*
+ * A definition of a SEL. Selectors are 16-bit, which limits the run-time to
+ * 65,535 selectors, unless the run-time is built with OBJC_LARGE_SELECTORS, in
+ * which case they are 24-bit and the dispatch tables have three levels.
+ * Modules need to be compiled with -fobjc-runtime=kernel-runtime-2 for the
+ * large selectors.
+ */
+#ifndef OBJC_LARGE_SELECTORS
+	#define OBJC_LARGE_SELECTORS 0
+#endif
+
+#if OBJC_LARGE_SELECTORS
+typedef uint32_t SEL;
+#define OBJC_SELECTOR_BITS 24
+#else
 typedef uint16_t SEL;
+#define OBJC_SELECTOR_BITS 16
+#endif
+
+/*
+ * Type of the retain count that KKObject keeps directly after the isa pointer.
+ * With OBJC_SMALL_RETAIN_COUNT, it is 16-bit so that small ivars of the
+ * subclasses fit into the padding after it, and retains beyond
+ * OBJC_RETAIN_COUNT_MAX are kept in a side table. The field is always followed
+ * by pointer-aligned data in compiler-generated protocols and constant
+ * strings, so their layout doesn't depend on this.
+ */
+#ifndef OBJC_SMALL_RETAIN_COUNT
+	#define OBJC_SMALL_RETAIN_COUNT 0
+#endif
+
+#if OBJC_SMALL_RETAIN_COUNT
+typedef int16_t objc_retain_count;
+#define OBJC_RETAIN_COUNT_MAX 0x7fff
+#else
+typedef int objc_retain_count;
+#define OBJC_RETAIN_COUNT_MAX 0x7fffffff
+#endif
 
 /* A definition of a method implementation function pointer. */
 typedef id(*IMP)(id target, SEL _cmd, ...);
@@ -116,7 +152,7 @@ typedef struct {
 struct objc_protocol {
 	/* The fields in KKObject */
 	Class isa;
-	int retain_count;
+	objc_retain_count retain_count;
 	
 	/* Protocol fields. */
 	OBJC_PROTOCOL_FIELDS;
@@ -154,8 +190,8 @@ enum{
 	OBJC_ASSOCIATION_COPY = 0x303,
 	
 	/*
-	 * A special association for storing weak refs. The weak refs are zeroed on
-	 * either objc_remove_associated_objects or objc_remove_associated_weak_refs.
+	 * A special association for storing weak refs. The weak refs are zeroed
+	 * when the associated objects are removed.
 	 */
 	OBJC_ASSOCIATION_WEAK_REF = 0x401
 };
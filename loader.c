@@ -9,6 +9,7 @@
 #include "init.h"
 #include "class_registry.h"
 #include "private.h"
+#include "method_cache.h"
 
 
 #ifndef _KERNEL
@@ -86,6 +87,8 @@ _objc_unload_IMPs_in_class(Class cl, void *kernel_module){
 			}
 		}
 	}
+	
+	objc_method_cache_flush();
 }
 
 static void
@@ -254,67 +257,58 @@ _objc_module_check_dependencies_for_unloading(struct objc_loader_module *module,
 }
 
 
-PRIVATE void
-_objc_load_module(struct objc_loader_module *module,
-				  void *kernel_module)
+/*
+ * Modules compiled for objc_abi_version_kernel_2 carry a precomputed selector
+ * table in addition to the version 1 fields.
+ */
+static inline int
+_objc_module_abi_version(struct objc_loader_module *module)
 {
-	if (!objc_runtime_initialized){
-		objc_runtime_init();
-	}
-	
-	/* First, check the version. */
-	objc_assert(module->version == objc_abi_version_kernel_1,
+	return module->version & ~objc_abi_flag_large_selectors;
+}
+
+static inline BOOL
+_objc_module_has_selector_table(struct objc_loader_module *module)
+{
+	return _objc_module_abi_version(module) >= objc_abi_version_kernel_2;
+}
+
+static inline void
+_objc_module_check_version(struct objc_loader_module *module)
+{
+	int version = _objc_module_abi_version(module);
+	objc_assert(version == objc_abi_version_kernel_1
+				|| version == objc_abi_version_kernel_2,
 				"Unknown version of module version (%i)\n", module->version);
 	
-	objc_debug_log("Loading a module named %s\n", module->name);
-	
+	/* The SEL size is baked into the module's data structures. */
+	BOOL large_selectors =
+				(module->version & objc_abi_flag_large_selectors) != 0;
+	objc_assert(large_selectors == OBJC_LARGE_SELECTORS,
+				"Module %s uses %d-bit selectors, but the run-time uses %d-bit"
+				" selectors!\n", module->name, large_selectors ? 24 : 16,
+				OBJC_SELECTOR_BITS);
+}
+
+static inline void
+_objc_module_register_selectors(struct objc_loader_module *module)
+{
 	struct objc_symbol_table *table = module->symbol_table;
-	objc_debug_log("Symbol table: %p\n", table);
-	objc_debug_log("\tSelector ref count: %i\n", table->selector_reference_count);
-	objc_debug_log("\tSelector refs: %p\n", table->selector_references);
-	objc_debug_log("\tClass count: %i\n", table->class_count);
-	objc_debug_log("\tClasses: %p\n", table->classes);
-	objc_debug_log("\tCategory count: %i\n", table->category_count);
-	objc_debug_log("\tCategories: %p\n", table->categories);
-	objc_debug_log("\tProtocol count: %i\n", table->protocol_count);
-	objc_debug_log("\tProtocols: %p\n", table->protocols);
-	
-	/* Register selectors. */
 	objc_register_selector_array(table->selector_references,
 								 table->selector_reference_count);
-	
-	for (int i = 0; i < table->class_count; ++i){
-		/* Mark the class as owned by the kernel module. */
-		table->classes[i]->kernel_module = kernel_module;
-		
-		objc_debug_log("Should be registering class[%i; %p] %s\n", i,
-					   table->classes[i],
-					   table->classes[i]->name);
-		
-		Class super_class = table->classes[i]->super_class;
-		objc_debug_log("\tSuperclass[%p]: %s\n",
-					   super_class,
-					   super_class == NULL ? "" : super_class->name);
-	}
-	
-	objc_class_register_classes(table->classes, table->class_count);
-	
-	
-	for (int i = 0; i < table->category_count; ++i){
-		objc_debug_log("Should be registering category[%i; %p] %s for class %s\n", i,
-					   table->categories[i],
-					   table->categories[i]->category_name,
-					   table->categories[i]->class_name);
-		objc_category_try_load(table->categories[i]);
-	}
-	
-	for (int i = 0; i < table->protocol_count; ++i){
-		objc_debug_log("Registering protocol %s\n", table->protocols[i]->name);
-		objc_registerProtocol(table->protocols[i]);
+	if (_objc_module_has_selector_table(module)){
+		objc_register_selector_table(table->selector_table,
+									 table->selector_table_count);
 	}
 }
 
+static struct objc_loader_statistics objc_loader_statistics;
 
+/*
+ * Loads all modules of a kernel module in phases - all selectors are
+ * registered first, then all classes (under a single lock), categories and
+ * protocols, and finally all the classes get resolved in one pass.
+ */
 PRIVATE void _objc_load_modules(struct objc_loader_module **begin,
                                 struct objc_loader_module **end,
 								void *kernel_module)
@@ -323,13 +317,100 @@ PRIVATE void _objc_load_modules(struct objc_loader_module **begin,
 				   begin, end);
 	objc_debug_log("Module count: %i\n", (int)(end - begin));
 	
+	if (!objc_runtime_initialized){
+		objc_runtime_init();
+	}
+	
 	struct objc_loader_module **module_ptr;
+	unsigned int class_count = 0;
+	unsigned int selector_count = 0;
+	uint64_t start = objc_uptime_nanoseconds();
+	
 	for (module_ptr = begin; module_ptr < end; module_ptr++) {
-		_objc_load_module(*module_ptr, kernel_module);
+		struct objc_loader_module *module = *module_ptr;
+		_objc_module_check_version(module);
+		
+		selector_count += module->symbol_table->selector_reference_count;
+		if (_objc_module_has_selector_table(module)){
+			selector_count += module->symbol_table->selector_table_count;
+		}
+		class_count += module->symbol_table->class_count;
+	}
+	
+	/* Grow the selector table once for all the modules. */
+	objc_reserve_selectors(selector_count);
+	
+	for (module_ptr = begin; module_ptr < end; module_ptr++) {
+		_objc_module_register_selectors(*module_ptr);
+	}
+	
+	uint64_t selectors_done = objc_uptime_nanoseconds();
+	
+	if (class_count > 0){
+		Class *classes = objc_alloc(class_count * sizeof(Class), M_CLASS_TYPE);
+		unsigned int index = 0;
+		for (module_ptr = begin; module_ptr < end; module_ptr++) {
+			struct objc_symbol_table *table = (*module_ptr)->symbol_table;
+			for (int i = 0; i < table->class_count; ++i){
+				/* Mark the class as owned by the kernel module. */
+				table->classes[i]->kernel_module = kernel_module;
+				classes[index++] = table->classes[i];
+			}
+		}
+		objc_class_register_classes(classes, class_count);
+		objc_dealloc(classes, M_CLASS_TYPE);
+	}
+	
+	uint64_t classes_done = objc_uptime_nanoseconds();
+	
+	for (module_ptr = begin; module_ptr < end; module_ptr++) {
+		struct objc_symbol_table *table = (*module_ptr)->symbol_table;
+		for (int i = 0; i < table->category_count; ++i){
+			objc_category_try_load(table->categories[i]);
+		}
+	}
+	
+	uint64_t categories_done = objc_uptime_nanoseconds();
+	
+	for (module_ptr = begin; module_ptr < end; module_ptr++) {
+		struct objc_symbol_table *table = (*module_ptr)->symbol_table;
+		for (int i = 0; i < table->protocol_count; ++i){
+			objc_registerProtocol(table->protocols[i]);
+		}
 	}
 	
+	uint64_t protocols_done = objc_uptime_nanoseconds();
+	
 	/* Now try to resolve all classes. */
 	objc_class_resolve_links();
+	
+	uint64_t resolving_done = objc_uptime_nanoseconds();
+	
+	OBJC_LOCK_RUNTIME_FOR_SCOPE();
+	objc_loader_statistics.selectors += selectors_done - start;
+	objc_loader_statistics.classes += classes_done - selectors_done;
+	objc_loader_statistics.categories += categories_done - classes_done;
+	objc_loader_statistics.protocols += protocols_done - categories_done;
+	objc_loader_statistics.resolving += resolving_done - protocols_done;
+	objc_loader_statistics.module_count += (unsigned int)(end - begin);
+	objc_loader_statistics.class_count += class_count;
+	
+	objc_debug_log("Loaded %u classes in %llu ns (selectors %llu, classes %llu,"
+				   " categories %llu, protocols %llu, resolving %llu)\n",
+				   class_count,
+				   (unsigned long long)(resolving_done - start),
+				   (unsigned long long)(selectors_done - start),
+				   (unsigned long long)(classes_done - selectors_done),
+				   (unsigned long long)(categories_done - classes_done),
+				   (unsigned long long)(protocols_done - categories_done),
+				   (unsigned long long)(resolving_done - protocols_done));
+}
+
+void
+objc_loader_get_statistics(struct objc_loader_statistics *stats)
+{
+	OBJC_LOCK_RUNTIME_FOR_SCOPE();
+	*stats = objc_loader_statistics;
 }
 
 PRIVATE BOOL
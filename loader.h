@@ -16,7 +16,16 @@
 
 /* Defined ABI versions. */
 enum objc_abi_version {
-	objc_abi_version_kernel_1 = 0x301
+	objc_abi_version_kernel_1 = 0x301,
+	
+	/* Adds the precomputed selector table to the symbol table. */
+	objc_abi_version_kernel_2 = 0x302,
+	
+	/*
+	 * Not a version, but a flag set in the version of modules compiled with
+	 * 24-bit selectors (-fobjc-runtime=kernel-runtime-2).
+	 */
+	objc_abi_flag_large_selectors = 0x10000
 };
 
 struct objc_symbol_table {
@@ -43,6 +52,18 @@ struct objc_symbol_table {
 	
 	/* Number of protocols. */
 	struct objc_protocol			  **protocols;
+	
+	/*
+	 * The following fields are only present in objc_abi_version_kernel_2
+	 * modules, which list their selectors here instead of in the
+	 * 'selector_references' field.
+	 */
+	
+	/* Number of selectors in the 'selector_table' field. */
+	unsigned int                      selector_table_count;
+	
+	/* Deduplicated selectors with precomputed name hashes. */
+	struct objc_precomputed_selector  *selector_table;
 };
 
 struct objc_loader_module {
@@ -58,8 +79,6 @@ struct objc_loader_module {
 
 
 
-PRIVATE void _objc_load_module(struct objc_loader_module *module,
-							   void *kernel_module);
 PRIVATE void _objc_load_modules(struct objc_loader_module **begin,
                                 struct objc_loader_module **end,
 								void *kernel_module);
@@ -32,12 +32,17 @@ MALLOC_DEFINE(M_PROTOCOL_MAP_TYPE, "protocol_table",
 MALLOC_DEFINE(M_PROTOCOL_TYPE, "protocol", "Objective-C Protocol");
 MALLOC_DEFINE(M_REFLIST_TYPE, "reference list", "Objective-C Associated "
               "Objects Reference List");
+MALLOC_DEFINE(M_RETAIN_COUNT_TYPE, "retain count", "Objective-C Retain "
+              "Count Side Table");
 MALLOC_DEFINE(M_SELECTOR_MAP_TYPE, "selector_map", "Objective-C selector map");
 MALLOC_DEFINE(M_SELECTOR_NAME_TYPE, "selector_names", "Objective-C "
               "Selector Names");
 MALLOC_DEFINE(M_SELECTOR_TYPE, "selectors", "Objective-C selectors");
 MALLOC_DEFINE(M_SLOT_POOL_TYPE, "slot_pool", "Objective-C slot pool");
 MALLOC_DEFINE(M_SPARSE_ARRAY_TYPE, "sparse_array", "Objective-C Sparse Array");
+MALLOC_DEFINE(M_SYNC_TYPE, "sync", "Objective-C @synchronized Locks");
 MALLOC_DEFINE(M_UTILITIES_TYPE, "objc_utils", "Objective-C run-time utilities");
+MALLOC_DEFINE(M_WEAK_REF_TYPE, "weak refs", "Objective-C Weak Reference "
+              "Table");
 
 
@@ -25,12 +25,15 @@ MALLOC_DECLARE(M_PROTOCOL_TYPE);
 MALLOC_DECLARE(M_PROTOCOL_LIST_TYPE);
 MALLOC_DECLARE(M_PROTOCOL_MAP_TYPE);
 MALLOC_DECLARE(M_REFLIST_TYPE);
+MALLOC_DECLARE(M_RETAIN_COUNT_TYPE);
 MALLOC_DECLARE(M_SELECTOR_MAP_TYPE);
 MALLOC_DECLARE(M_SELECTOR_NAME_TYPE);
 MALLOC_DECLARE(M_SELECTOR_TYPE);
 MALLOC_DECLARE(M_SLOT_POOL_TYPE);
 MALLOC_DECLARE(M_SPARSE_ARRAY_TYPE);
+MALLOC_DECLARE(M_SYNC_TYPE);
 MALLOC_DECLARE(M_UTILITIES_TYPE);
+MALLOC_DECLARE(M_WEAK_REF_TYPE);
 
 
 #endif /* OBJC_MALLOC_TYPES_H */
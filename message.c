@@ -9,6 +9,7 @@
 #include "dtable.h"
 #include "class.h"
 #include "private.h"
+#include "method_cache.h"
 
 /*
  * Static functions and slots for nil receivers.
@@ -62,14 +63,60 @@ struct objc_slot *(*objc_plane_lookup)(id *receiver, SEL op, id sender)
 												= objc_msg_lookup_default;
 
 
+/*
+ * Called when the class doesn't implement the selector. Gives the proxy and
+ * forwarding hooks a chance to handle the message.
+ */
+static inline struct objc_slot *
+_objc_msg_lookup_forward(id *receiver, SEL selector, id sender)
+{
+	/* Default hooks wouldn't do anything but return the nil slot. */
+	if (objc_proxy_lookup == objc_proxy_lookup_default
+		&& __objc_msg_forward3 == objc_msg_forward3_default){
+		return &nil_slot;
+	}
+	
+	id newReceiver = objc_proxy_lookup(*receiver, selector);
+	/*
+	 * If some other library wants us to play forwarding
+	 * games, try again with the new object.
+	 */
+	if (nil != newReceiver) {
+		*receiver = newReceiver;
+		return objc_msg_lookup_sender(receiver,
+									  selector,
+									  sender);
+	}
+	return __objc_msg_forward3(*receiver, selector);
+}
+
 /* Uncomment for debugging */
 /* __attribute__((noinline)) */
 __attribute__((always_inline)) struct objc_slot *
 objc_msg_lookup_default(id *receiver, SEL selector, id sender)
 {
 	Class class = objc_object_get_class_inline((*receiver));
-	struct objc_slot *result = objc_dtable_lookup(class->dtable, selector);
-	if (UNLIKELY(NULL == result)) {
+	struct objc_slot *result = objc_method_cache_lookup(class, selector);
+	if (LIKELY(NULL != result)) {
+		if (UNLIKELY(OBJC_METHOD_CACHE_ABSENT == result)) {
+			return _objc_msg_lookup_forward(receiver, selector, sender);
+		}
+		return result;
+	}
+	
+	unsigned long epoch = objc_method_cache_epoch;
+	objc_load_barrier();
+	
+	result = objc_dtable_lookup(class->dtable, selector);
+	if (LIKELY(NULL != result)) {
+		/*
+		 * Only cache slots from installed dtables. Fake classes come and
+		 * go with their objects, so they'd just evict the real ones.
+		 */
+		if (!class->flags.fake){
+			objc_method_cache_insert(class, selector, result, epoch);
+		}
+	} else {
 		dtable_t dtable = dtable_for_class(class);
 		/* Install the dtable if it hasn't already been initialized. */
 		if (dtable == uninstalled_dtable){
@@ -84,22 +131,16 @@ objc_msg_lookup_default(id *receiver, SEL selector, id sender)
 			 * while we weren't looking.
 			 */
 			result = objc_dtable_lookup(dtable, selector);
+			
+			/* Remember the miss if the class is fully initialized. */
+			if (NULL == result && dtable == class->dtable
+				&& !class->flags.fake){
+				objc_method_cache_insert(class, selector,
+										 OBJC_METHOD_CACHE_ABSENT, epoch);
+			}
 		}
 		if (NULL == result) {
-			id newReceiver = objc_proxy_lookup(*receiver, selector);
-			/*
-			 * If some other library wants us to play forwarding
-			 * games, try again with the new object.
-			 */
-			if (nil != newReceiver) {
-				*receiver = newReceiver;
-				return objc_msg_lookup_sender(receiver,
-											  selector,
-											  sender);
-			} else {
-				result = __objc_msg_forward3(*receiver,
-											 selector);
-			}
+			result = _objc_msg_lookup_forward(receiver, selector, sender);
 		}
 	}
 	return result;
@@ -160,6 +201,78 @@ objc_msg_lookup_sender(id *receiver, SEL selector, id sender)
 	return objc_msg_lookup_default(receiver, selector, sender);
 }
 
+/*
+ * Incremented each time a dtable of a real class is freed. Call-site caches
+ * remember the value when they are filled so that a class allocated at the
+ * address of a freed one doesn't hit a stale entry.
+ */
+PRIVATE unsigned long objc_dtable_generation;
+
+/*
+ * Same as objc_msg_lookup_sender, but first consults the call-site cache
+ * supplied by the compiler. Only slots found in an installed dtable are
+ * cached - anything else (nil receivers, +initialize in progress, forwarding)
+ * goes through the regular lookup each time.
+ */
+struct objc_slot *
+objc_msg_lookup_cached(id *receiver, SEL selector, id sender,
+					   struct objc_call_site_cache *cache)
+{
+	if (UNLIKELY(*receiver == nil)){
+		return objc_msg_lookup_sender(receiver, selector, sender);
+	}
+
+	Class class = objc_object_get_class_inline(*receiver);
+	volatile struct objc_call_site_cache *entry = cache;
+
+	unsigned int seq = entry->seq;
+	objc_load_barrier();
+	if (LIKELY((seq & 1) == 0) && entry->cls == class){
+		struct objc_slot *slot = entry->slot;
+		unsigned int version = entry->version;
+		unsigned long generation = entry->generation;
+		objc_load_barrier();
+		if (LIKELY(entry->seq == seq && slot->version == version
+				   && generation == objc_dtable_generation)){
+			return slot;
+		}
+	}
+
+	unsigned long generation = objc_dtable_generation;
+	objc_load_barrier();
+
+	struct objc_slot *slot = objc_dtable_lookup(class->dtable, selector);
+	if (UNLIKELY(slot == NULL)){
+		/* Not installed yet, or not implemented at all. */
+		return objc_msg_lookup_default(receiver, selector, sender);
+	}
+
+	/*
+	 * Read the version and make sure the slot is still the one installed.
+	 * If it got replaced in the meantime, the version we've read may
+	 * already be the bumped one, so don't cache it.
+	 */
+	unsigned int version = slot->version;
+	objc_load_barrier();
+	if (class->flags.fake
+		|| objc_dtable_lookup(class->dtable, selector) != slot){
+		return slot;
+	}
+
+	/* If some other thread is filling the entry, leave it be. */
+	if ((seq & 1) == 0 && __sync_bool_compare_and_swap(&cache->seq, seq,
+													   seq + 1)){
+		entry->cls = class;
+		entry->slot = slot;
+		entry->version = version;
+		entry->generation = generation;
+		__sync_synchronize();
+		entry->seq = seq + 2;
+	}
+
+	return slot;
+}
+
 PRIVATE struct objc_slot *
 objc_get_slot(Class cl, SEL selector)
 {
@@ -167,15 +280,36 @@ objc_get_slot(Class cl, SEL selector)
 				   class_getName(cl),
 				   cl->flags.meta ? "YES" : "NO",
 				   cl->flags.fake ? "YES" : "NO");
-	struct objc_slot *slot = objc_dtable_lookup(cl->dtable, selector);
+	struct objc_slot *slot = objc_method_cache_lookup(cl, selector);
+	if (slot != NULL){
+		return slot == OBJC_METHOD_CACHE_ABSENT ? NULL : slot;
+	}
+	
+	unsigned long epoch = objc_method_cache_epoch;
+	objc_load_barrier();
+	
+	dtable_t dtable = cl->dtable;
+	slot = objc_dtable_lookup(dtable, selector);
 	if (slot == NULL){
-		dtable_t dtable = dtable_for_class(cl);
+		dtable = dtable_for_class(cl);
 		if (dtable == uninstalled_dtable){
 			dtable = dtable_for_class(cl);
 		}
 		
 		slot = objc_dtable_lookup(dtable, selector);
 	}
+	
+	/*
+	 * Only cache what was found in the installed dtable - a miss in the
+	 * uninstalled or a temporary dtable says nothing about the class, and
+	 * installing the dtable doesn't flush the cache.
+	 */
+	if (dtable == cl->dtable && dtable != uninstalled_dtable
+		&& !cl->flags.fake){
+		objc_method_cache_insert(cl, selector,
+								 slot == NULL ? OBJC_METHOD_CACHE_ABSENT : slot,
+								 epoch);
+	}
 	return slot;
 }
 
@@ -215,19 +349,37 @@ _class_getIMPForSelector(Class cl, SEL selector){
 		if (cl->flags.fake) {
 			/* Fake classes only have dtables. */
 			cl = objc_class_get_nonfake_inline(cl);
+			if (cl == Nil){
+				return NULL;
+			}
 		}
 		
-		struct objc_method_list_struct *method_list = cl->methods;
-		while (method_list != NULL){
-			for (int i = 0; i < method_list->size; ++i){
-				if (method_list->list[i].selector == selector){
-					return method_list->list[i].implementation;
+		struct objc_method *method = objc_method_cache_lookup_method(cl,
+																	 selector);
+		if (method == NULL){
+			unsigned long epoch = objc_method_cache_epoch;
+			objc_load_barrier();
+			
+			struct objc_method_list_struct *method_list = cl->methods;
+			while (method_list != NULL && method == NULL){
+				for (int i = 0; i < method_list->size; ++i){
+					if (method_list->list[i].selector == selector){
+						method = &method_list->list[i];
+						break;
+					}
 				}
+				method_list = method_list->next;
 			}
-			method_list = method_list->next;
+			
+			/* Misses are cached too, so the walk is only done once. */
+			objc_method_cache_insert_method(cl, selector, method, epoch);
 		}
 		
-		return _class_getIMPForSelector(cl, selector);
+		if (method != NULL
+			&& method != (struct objc_method *)OBJC_METHOD_CACHE_ABSENT){
+			return method->implementation;
+		}
+		return _class_getIMPForSelector(cl->super_class, selector);
 	}
 }
 
@@ -9,6 +9,7 @@
 #include "private.h"
 #include "runtime.h"
 #include "utils.h"
+#include "method_cache.h"
 
 /*
  * Adds methods from the array 'm' into the method_list. The m array doesn't
@@ -35,6 +36,9 @@ _add_methods_to_class(Class cl, Method *m, unsigned int count)
 	
 	if (cl->dtable != uninstalled_dtable){
 		dtable_add_method_list_to_class(cl, list);
+	}else{
+		/* Drop the cached misses of the method lists. */
+		objc_method_cache_flush();
 	}
 }
 
@@ -59,6 +63,8 @@ static inline void _class_addMethodsFromList(Class target,
 	
 	if (target->dtable != uninstalled_dtable){
 		dtable_add_method_list_to_class(target, list);
+	}else{
+		objc_method_cache_flush();
 	}
 }
 
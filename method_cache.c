@@ -0,0 +1,49 @@
+#include "os.h"
+#include "kernobjc/types.h"
+#include "types.h"
+#include "method_cache.h"
+
+PRIVATE struct objc_method_cache_entry objc_method_cache[OBJC_METHOD_CACHE_SIZE];
+
+PRIVATE struct objc_slot objc_method_cache_absent_slot;
+
+/* Starts at 1 so that zeroed entries never match. */
+PRIVATE volatile unsigned long objc_method_cache_epoch = 1;
+
+PRIVATE void
+objc_method_cache_insert(Class cls, SEL selector, struct objc_slot *slot,
+						 unsigned long epoch)
+{
+	unsigned int index = objc_method_cache_index(cls, selector);
+	struct objc_method_cache_entry *victim = NULL;
+
+	/* Prefer an entry that is stale, otherwise evict the first one. */
+	for (int i = 0; i < OBJC_METHOD_CACHE_PROBES; ++i){
+		struct objc_method_cache_entry *entry =
+			&objc_method_cache[(index + i) & OBJC_METHOD_CACHE_MASK];
+		if (entry->epoch != epoch || (entry->cls == cls
+									  && entry->selector == selector)){
+			victim = entry;
+			break;
+		}
+	}
+	if (victim == NULL){
+		victim = &objc_method_cache[index];
+	}
+
+	volatile struct objc_method_cache_entry *entry = victim;
+	unsigned int seq = entry->seq;
+
+	/* If some other thread is filling the entry, leave it be. */
+	if ((seq & 1) != 0 || !__sync_bool_compare_and_swap(&victim->seq, seq,
+														 seq + 1)){
+		return;
+	}
+
+	entry->cls = cls;
+	entry->selector = selector;
+	entry->slot = slot;
+	entry->epoch = epoch;
+	__sync_synchronize();
+	entry->seq = seq + 2;
+}
@@ -0,0 +1,137 @@
+
+#ifndef OBJC_METHOD_CACHE_H
+#define OBJC_METHOD_CACHE_H
+
+/*
+ * A global (class, selector) -> slot cache that is consulted before the
+ * dtables. Most sends go to a few hundred (class, selector) pairs, so one
+ * hashed probe into a hot cache line is cheaper than walking the sparse array.
+ *
+ * The cache is open-addressed with OBJC_METHOD_CACHE_PROBES entries probed
+ * per lookup. Each entry is guarded by a sequence counter (odd while the entry
+ * is being written), so lookups never take a lock. Instead of clearing the
+ * entries, the cache is invalidated by bumping the epoch - entries filled
+ * during an older epoch are ignored.
+ */
+
+/* Must be a power of two. */
+#define OBJC_METHOD_CACHE_SIZE		1024
+#define OBJC_METHOD_CACHE_MASK		(OBJC_METHOD_CACHE_SIZE - 1)
+#define OBJC_METHOD_CACHE_PROBES	2
+
+struct objc_method_cache_entry {
+	unsigned int seq;
+	SEL selector;
+	Class cls;
+	struct objc_slot *slot;
+	unsigned long epoch;
+} __attribute__((aligned(32)));
+
+PRIVATE extern struct objc_method_cache_entry
+							objc_method_cache[OBJC_METHOD_CACHE_SIZE];
+
+/*
+ * Negative entries - selectors known not to be in the class's dtable - are
+ * cached with this slot, so that repeated misses (e.g. probing optional
+ * delegate methods) don't need to go through dtable_for_class.
+ */
+PRIVATE extern struct objc_slot objc_method_cache_absent_slot;
+#define OBJC_METHOD_CACHE_ABSENT (&objc_method_cache_absent_slot)
+
+PRIVATE extern volatile unsigned long objc_method_cache_epoch;
+
+static inline unsigned int
+objc_method_cache_index(Class cls, SEL selector)
+{
+	uintptr_t hash = ((uintptr_t)cls >> 4) ^ ((uintptr_t)selector * 0x9E3779B1);
+	return (unsigned int)(hash & OBJC_METHOD_CACHE_MASK);
+}
+
+/*
+ * Returns the cached slot for the (cls, selector) pair, or NULL if the pair
+ * isn't cached. Returns OBJC_METHOD_CACHE_ABSENT if the class is known not to
+ * implement the selector.
+ */
+static inline struct objc_slot *
+objc_method_cache_lookup(Class cls, SEL selector)
+{
+	unsigned long epoch = objc_method_cache_epoch;
+	unsigned int index = objc_method_cache_index(cls, selector);
+	for (int i = 0; i < OBJC_METHOD_CACHE_PROBES; ++i){
+		volatile struct objc_method_cache_entry *entry =
+			&objc_method_cache[(index + i) & OBJC_METHOD_CACHE_MASK];
+		unsigned int seq = entry->seq;
+		if (UNLIKELY(seq & 1)){
+			continue;
+		}
+
+		objc_load_barrier();
+		if (entry->cls == cls && entry->selector == selector
+			&& entry->epoch == epoch){
+			struct objc_slot *slot = entry->slot;
+			objc_load_barrier();
+			if (LIKELY(entry->seq == seq)){
+				return slot;
+			}
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Caches the slot for the (cls, selector) pair. The epoch must be read before
+ * the slot was looked up in the dtable, so that a slot looked up before a flush
+ * doesn't get cached.
+ */
+PRIVATE void objc_method_cache_insert(Class cls, SEL selector,
+									  struct objc_slot *slot,
+									  unsigned long epoch);
+
+/*
+ * Classes whose dtable hasn't been installed yet are looked up in their own
+ * method lists. The method found there is cached under the class pointer with
+ * the low bit set, which no dtable lookup uses, so the entries are no longer
+ * consulted once the dtable is installed.
+ */
+static inline Class
+objc_method_cache_method_list_key(Class cls)
+{
+	return (Class)((uintptr_t)cls | 1);
+}
+
+/*
+ * Returns the cached method of the class's own method lists, NULL if it isn't
+ * cached, or OBJC_METHOD_CACHE_ABSENT if none of the lists contains the
+ * selector.
+ */
+static inline struct objc_method *
+objc_method_cache_lookup_method(Class cls, SEL selector)
+{
+	struct objc_slot *slot = objc_method_cache_lookup(
+					objc_method_cache_method_list_key(cls), selector);
+	if (slot == OBJC_METHOD_CACHE_ABSENT){
+		return (struct objc_method *)OBJC_METHOD_CACHE_ABSENT;
+	}
+	return (struct objc_method *)slot;
+}
+
+static inline void
+objc_method_cache_insert_method(Class cls, SEL selector,
+								struct objc_method *method, unsigned long epoch)
+{
+	objc_method_cache_insert(objc_method_cache_method_list_key(cls), selector,
+							 method == NULL ? OBJC_METHOD_CACHE_ABSENT
+							 : (struct objc_slot *)method, epoch);
+}
+
+/*
+ * Invalidates all cache entries. Must be called after a dtable gets modified
+ * or freed, and after methods are added to a class without a dtable.
+ */
+static inline void
+objc_method_cache_flush(void)
+{
+	__sync_fetch_and_add(&objc_method_cache_epoch, 1);
+}
+
+#endif /* !OBJC_METHOD_CACHE_H */
@@ -13,6 +13,17 @@
 #define LIKELY(x) __builtin_expect(x, 1)
 #define UNLIKELY(x) __builtin_expect(x, 0)
 
+/*
+ * Keeps the loads before the barrier from being reordered with the loads
+ * after it. x86 doesn't reorder loads with other loads, so only the compiler
+ * needs to be stopped there.
+ */
+#if defined(__i386__) || defined(__x86_64__)
+	#define objc_load_barrier() __asm__ __volatile__("" ::: "memory")
+#else
+	#define objc_load_barrier() __sync_synchronize()
+#endif
+
 
 /* Preprocessor magic */
 #define REALLY_PREFIX_SUFFIX(x, y) x ## y
@@ -2,6 +2,8 @@
 #include <sys/types.h>
 #include <sys/systm.h>
 #include <sys/proc.h>
+#include <sys/pcpu.h>
+#include <sys/smp.h>
 #include <sys/lock.h>
 #include <sys/sx.h>
 #include <sys/kernel.h>
@@ -9,9 +11,11 @@
 #include <sys/module.h>
 #include <sys/linker.h>
 #include <sys/osd.h>
+#include <sys/time.h>
 #include <ddb/ddb.h>
 
 #include <machine/setjmp.h>
+#include <machine/cpu.h>
 
 /* LOGGING */
 #define objc_log db_printf
@@ -33,6 +37,14 @@ static inline const char *objc_rw_lock_get_name(objc_rw_lock *lock){
 static inline void objc_rw_lock_init(objc_rw_lock *lock, const char *name){
 	sx_init_flags(lock, name, SX_RECURSE);
 }
+/*
+ * For locks sharing a name of which several may be held at once. Witness
+ * would otherwise complain about acquiring a duplicate lock.
+ */
+static inline void objc_rw_lock_init_dupok(objc_rw_lock *lock,
+					   const char *name){
+	sx_init_flags(lock, name, SX_RECURSE | SX_DUPOK);
+}
 static inline int objc_rw_lock_rlock(objc_rw_lock *lock){
 	sx_slock(lock);
 	return 0;
@@ -49,10 +61,55 @@ static inline void objc_rw_lock_destroy(objc_rw_lock *lock){
 	sx_destroy(lock);
 }
 
+/*
+ * A recursive mutex, that may be held for a longer time, e.g. for the
+ * duration of a @synchronized block. It needs to be sleepable, since the
+ * code holding it may sleep, hence sx as well. The sx locks spin adaptively
+ * while the owner is running.
+ */
+typedef struct sx objc_mutex;
+
+static inline void objc_mutex_init(objc_mutex *mutex, const char *name){
+	sx_init_flags(mutex, name, SX_RECURSE | SX_DUPOK);
+}
+static inline int objc_mutex_lock(objc_mutex *mutex){
+	sx_xlock(mutex);
+	return 0;
+}
+static inline int objc_mutex_unlock(objc_mutex *mutex){
+	sx_xunlock(mutex);
+	return 0;
+}
+static inline void objc_mutex_destroy(objc_mutex *mutex){
+	sx_destroy(mutex);
+}
+
 /* THREAD */
 static inline void objc_yield(void){
 	pause("objc_yield", 0);
 }
+/* Hints the CPU that we're busy-waiting. */
+static inline void objc_cpu_relax(void){
+	cpu_spinwait();
+}
+/*
+ * The CPU the thread is running on, which may change right after. It is
+ * always below objc_cpu_count(), which is at most OBJC_MAX_CPUS.
+ */
+#define OBJC_MAX_CPUS MAXCPU
+static inline unsigned int objc_cpu_id(void){
+	return curcpu;
+}
+static inline unsigned int objc_cpu_count(void){
+	return mp_maxid + 1;
+}
+
+/* TIME */
+static inline uint64_t objc_uptime_nanoseconds(void){
+	struct timespec ts;
+	nanouptime(&ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
 #define objc_abort(reason...) panic(reason)
 
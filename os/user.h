@@ -5,7 +5,9 @@
 #include <stddef.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <sched.h>
 #include <setjmp.h>
+#include <time.h>
 
 #define PAGE_SIZE 4096
 
@@ -37,6 +39,10 @@ static inline void objc_rw_lock_init(objc_rw_lock *lock, const char *name){
 	++objc_lock_count;
 	pthread_rwlock_init(&lock->lock, NULL);
 }
+static inline void objc_rw_lock_init_dupok(objc_rw_lock *lock,
+					   const char *name){
+	objc_rw_lock_init(lock, name);
+}
 static inline int objc_rw_lock_rlock(objc_rw_lock *lock){
 	++lock->locked;
 	++objc_lock_locked_count;
@@ -62,6 +68,32 @@ static inline const char *objc_rw_lock_get_name(objc_rw_lock *lock){
 	return lock->name;
 }
 
+/*
+ * A recursive mutex, that may be held for a longer time, e.g. for the
+ * duration of a @synchronized block.
+ */
+typedef pthread_mutex_t objc_mutex;
+
+static inline void objc_mutex_init(objc_mutex *mutex, const char *name){
+	pthread_mutexattr_t attributes;
+	pthread_mutexattr_init(&attributes);
+	pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+	++objc_lock_count;
+	pthread_mutex_init(mutex, &attributes);
+	pthread_mutexattr_destroy(&attributes);
+}
+static inline int objc_mutex_lock(objc_mutex *mutex){
+	++objc_lock_locked_count;
+	return pthread_mutex_lock(mutex);
+}
+static inline int objc_mutex_unlock(objc_mutex *mutex){
+	return pthread_mutex_unlock(mutex);
+}
+static inline void objc_mutex_destroy(objc_mutex *mutex){
+	++objc_lock_destroy_count;
+	pthread_mutex_destroy(mutex);
+}
+
 /* MEMORY */
 
 /*
@@ -90,7 +122,37 @@ static inline void objc_dealloc(void *mem, void *type){
 
 /* THREAD */
 static inline void objc_yield(void){
-	sleep(0);
+	sched_yield();
+}
+/* Hints the CPU that we're busy-waiting. */
+static inline void objc_cpu_relax(void){
+#if defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}
+/*
+ * The CPU the thread is running on, which may change right after. It is
+ * always below objc_cpu_count(), which is at most OBJC_MAX_CPUS. CPUs beyond
+ * OBJC_MAX_CPUS share the ids.
+ */
+#define OBJC_MAX_CPUS 64
+static inline unsigned int objc_cpu_id(void){
+	int cpu = sched_getcpu();
+	return cpu < 0 ? 0 : (unsigned int)cpu % OBJC_MAX_CPUS;
+}
+static inline unsigned int objc_cpu_count(void){
+	return OBJC_MAX_CPUS;
+}
+
+/* TIME */
+static inline uint64_t objc_uptime_nanoseconds(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
 #define objc_abort(reason...)	{					\
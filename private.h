@@ -54,6 +54,17 @@ void objc_classes_dump(void);
 struct objc_slot *objc_msg_lookup_sender_non_nil(id *receiver, SEL selector,
 												 id sender);
 
+/* Looks up a slot, using (and filling) a call-site cache emitted by the
+ * compiler.
+ */
+struct objc_slot *objc_msg_lookup_cached(id *receiver, SEL selector, id sender,
+										 struct objc_call_site_cache *cache);
+
+/* Bumped whenever a dtable of a real class is freed. Invalidates all
+ * call-site caches.
+ */
+PRIVATE extern unsigned long objc_dtable_generation;
+
 /* Looks up a slot on super. */
 PRIVATE struct objc_slot *objc_slot_lookup_super(struct objc_super *super,
 												 SEL selector);
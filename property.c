@@ -14,7 +14,159 @@
 #include "kernobjc/property.h"
 #include "private.h"
 
-PRIVATE int spinlocks[spinlock_count];
+PRIVATE struct objc_spinlock spinlocks[spinlock_count];
+
+/*
+ * Atomic object properties don't take the spinlocks. The setters swap the
+ * ivar with an atomic exchange and the getters load and retain it without
+ * any lock, so the getters never wait for each other.
+ *
+ * What remains is that a getter may load the old value just before the
+ * setter swaps it, and retain it only after the setter has released it.
+ * Hence the getters announce themselves in the reader counters of the CPU
+ * they run on, which stay in that CPU's cache, and an old value is only
+ * released once no getter that could have loaded it is running.
+ *
+ * The setters never wait for the getters. If some getters are running, the
+ * old value is put aside in the current epoch. An epoch may end once the
+ * getters that started in the epoch before it are gone, and the values put
+ * aside in that one get released then. As nobody waits, a custom -retain
+ * sent by a getter may even set atomic properties itself.
+ */
+struct objc_property_readers {
+	/* Running getters by the parity of the epoch they started in. */
+	volatile unsigned long count[2];
+} __attribute__((aligned(64)));
+
+static struct objc_property_readers objc_property_readers[OBJC_MAX_CPUS];
+
+/* Read by every getter, hence in a cache line of its own. */
+static struct {
+	volatile unsigned int value;
+} __attribute__((aligned(64))) objc_property_epoch;
+
+struct objc_property_retired_value {
+	struct objc_property_retired_value	*next;
+	id					value;
+};
+
+/*
+ * Values put aside in the current and in the previous epoch, by the parity of
+ * the epoch. Guarded by objc_property_retired_lock.
+ */
+static struct objc_property_retired_value *volatile objc_property_retired[2];
+static struct objc_spinlock objc_property_retired_lock;
+
+static inline id
+_objc_property_load_atomic(id *addr)
+{
+	struct objc_property_readers *readers =
+				&objc_property_readers[objc_cpu_id()];
+	unsigned int index = objc_property_epoch.value & 1;
+	__sync_fetch_and_add(&readers->count[index], 1);
+	id ret = objc_retain(*(id volatile *)addr);
+	__sync_fetch_and_sub(&readers->count[index], 1);
+	return ret;
+}
+
+/*
+ * Returns YES if no getter that started in an epoch of the parity is running.
+ */
+static inline BOOL
+_objc_property_readers_gone(unsigned int index)
+{
+	unsigned int count = objc_cpu_count();
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		if (objc_property_readers[i].count[index] != 0)
+		{
+			return NO;
+		}
+	}
+	return YES;
+}
+
+/*
+ * Ends the current epoch unless there are getters from the previous one still
+ * running. The values put aside in the previous epoch are then safe to
+ * release and are returned in released. Needs objc_property_retired_lock.
+ */
+static BOOL
+_objc_property_end_epoch(struct objc_property_retired_value **released)
+{
+	unsigned int previous = (objc_property_epoch.value & 1) ^ 1;
+	if (!_objc_property_readers_gone(previous))
+	{
+		return NO;
+	}
+	
+	*released = objc_property_retired[previous];
+	objc_property_retired[previous] = NULL;
+	__sync_fetch_and_add(&objc_property_epoch.value, 1);
+	return YES;
+}
+
+static void
+_objc_property_release_values(struct objc_property_retired_value *values)
+{
+	while (values != NULL)
+	{
+		struct objc_property_retired_value *next = values->next;
+		objc_release(values->value);
+		objc_dealloc(values, M_PROPERTY_TYPE);
+		values = next;
+	}
+}
+
+/*
+ * Stores the (already retained) value and releases the old one - right away,
+ * unless a getter that might have loaded it is running.
+ */
+static inline void
+_objc_property_store_atomic(id *addr, id value)
+{
+	id old = __sync_lock_test_and_set(addr, value);
+	__sync_synchronize();
+	
+	if (old != nil && _objc_property_readers_gone(0)
+		&& _objc_property_readers_gone(1))
+	{
+		objc_release(old);
+		old = nil;
+	}
+	if (old == nil && objc_property_retired[0] == NULL
+		&& objc_property_retired[1] == NULL)
+	{
+		return;
+	}
+	
+	struct objc_property_retired_value *retired = NULL;
+	if (old != nil)
+	{
+		retired = objc_alloc(sizeof(struct objc_property_retired_value),
+							 M_PROPERTY_TYPE);
+		retired->value = old;
+	}
+	
+	/*
+	 * Ending two epochs releases the value put aside right now as well, if
+	 * the getters let us. The values are released after unlocking, as the
+	 * release may set atomic properties.
+	 */
+	struct objc_property_retired_value *released[2] = { NULL, NULL };
+	lock_spinlock(&objc_property_retired_lock);
+	if (retired != NULL)
+	{
+		unsigned int index = objc_property_epoch.value & 1;
+		retired->next = objc_property_retired[index];
+		objc_property_retired[index] = retired;
+	}
+	for (int i = 0; i < 2 && _objc_property_end_epoch(&released[i]); ++i);
+	unlock_spinlock(&objc_property_retired_lock);
+	
+	_objc_property_release_values(released[0]);
+	_objc_property_release_values(released[1]);
+}
 
 static inline BOOL checkAttribute(char field, int attr)
 {
@@ -37,11 +189,7 @@ id objc_getProperty(id obj, SEL _cmd, ptrdiff_t offset, BOOL isAtomic)
 	id ret;
 	if (isAtomic)
 	{
-		volatile int *lock = lock_for_pointer(addr);
-		lock_spinlock(lock);
-		ret = *(id*)addr;
-		ret = objc_retain(ret);
-		unlock_spinlock(lock);
+		ret = _objc_property_load_atomic((id*)addr);
 		ret = objc_autorelease(ret);
 	}
 	else
@@ -66,21 +214,16 @@ void objc_setProperty(id obj, SEL _cmd, ptrdiff_t offset, id arg, BOOL isAtomic,
 	{
 		arg = objc_retain(arg);
 	}
-	id old;
 	if (isAtomic)
 	{
-		volatile int *lock = lock_for_pointer(addr);
-		lock_spinlock(lock);
-		old = *(id*)addr;
-		*(id*)addr = arg;
-		unlock_spinlock(lock);
+		_objc_property_store_atomic((id*)addr, arg);
 	}
 	else
 	{
-		old = *(id*)addr;
+		id old = *(id*)addr;
 		*(id*)addr = arg;
+		objc_release(old);
 	}
-	objc_release(old);
 }
 
 void objc_setProperty_atomic(id obj, SEL _cmd, id arg, ptrdiff_t offset)
@@ -88,12 +231,7 @@ void objc_setProperty_atomic(id obj, SEL _cmd, id arg, ptrdiff_t offset)
 	char *addr = (char*)obj;
 	addr += offset;
 	arg = objc_retain(arg);
-	volatile int *lock = lock_for_pointer(addr);
-	lock_spinlock(lock);
-	id old = *(id*)addr;
-	*(id*)addr = arg;
-	unlock_spinlock(lock);
-	objc_release(old);
+	_objc_property_store_atomic((id*)addr, arg);
 }
 
 void objc_setProperty_atomic_copy(id obj, SEL _cmd, id arg, ptrdiff_t offset)
@@ -102,12 +240,7 @@ void objc_setProperty_atomic_copy(id obj, SEL _cmd, id arg, ptrdiff_t offset)
 	addr += offset;
 
 	arg = _objc_copy_object(arg);
-	volatile int *lock = lock_for_pointer(addr);
-	lock_spinlock(lock);
-	id old = *(id*)addr;
-	*(id*)addr = arg;
-	unlock_spinlock(lock);
-	objc_release(old);
+	_objc_property_store_atomic((id*)addr, arg);
 }
 
 void objc_setProperty_nonatomic(id obj, SEL _cmd, id arg, ptrdiff_t offset)
@@ -145,13 +278,29 @@ void objc_copyPropertyStruct(void *dest,
 {
 	if (atomic)
 	{
-		volatile int *lock = lock_for_pointer(src < dest ? src : dest);
-		volatile int *lock2 = lock_for_pointer(src < dest ? dest : src);
+		/*
+		 * Both pointers may hash to the same lock. Otherwise, the locks are
+		 * taken in the order of their addresses.
+		 */
+		struct objc_spinlock *lock = lock_for_pointer(src);
+		struct objc_spinlock *lock2 = lock_for_pointer(dest);
+		if (lock2 < lock)
+		{
+			struct objc_spinlock *tmp = lock;
+			lock = lock2;
+			lock2 = tmp;
+		}
 		lock_spinlock(lock);
-		lock_spinlock(lock2);
+		if (lock2 != lock)
+		{
+			lock_spinlock(lock2);
+		}
 		memcpy(dest, src, size);
+		if (lock2 != lock)
+		{
+			unlock_spinlock(lock2);
+		}
 		unlock_spinlock(lock);
-		unlock_spinlock(lock2);
 	}
 	else
 	{
@@ -171,7 +320,7 @@ void objc_getPropertyStruct(void *dest,
 {
 	if (atomic)
 	{
-		volatile int *lock = lock_for_pointer(src);
+		struct objc_spinlock *lock = lock_for_pointer(src);
 		lock_spinlock(lock);
 		memcpy(dest, src, size);
 		unlock_spinlock(lock);
@@ -194,7 +343,7 @@ void objc_setPropertyStruct(void *dest,
 {
 	if (atomic)
 	{
-		volatile int *lock = lock_for_pointer(dest);
+		struct objc_spinlock *lock = lock_for_pointer(dest);
 		lock_spinlock(lock);
 		memcpy(dest, src, size);
 		unlock_spinlock(lock);
@@ -205,6 +354,18 @@ void objc_setPropertyStruct(void *dest,
 	}
 }
 
+void
+objc_spinlock_get_statistics(struct objc_spinlock_statistics *stats)
+{
+	memset(stats, 0, sizeof(struct objc_spinlock_statistics));
+	for (int i = 0; i < spinlock_count; ++i)
+	{
+		stats->contended += spinlocks[i].contended;
+		stats->spins += spinlocks[i].spins;
+		stats->yields += spinlocks[i].yields;
+	}
+}
+
 
 Property class_getProperty(Class cls, const char *name)
 {
@@ -0,0 +1,157 @@
+#include "os.h"
+#include "kernobjc/types.h"
+#include "types.h"
+#include "refcount.h"
+#include "init.h"
+#include "utils.h"
+
+/*
+ * Number of retains of an object beyond OBJC_RETAIN_COUNT_MAX. Objects only
+ * have an entry while their count in the side table is non-zero.
+ */
+struct objc_retain_count_entry {
+	id object;
+	unsigned long count;
+};
+
+/*
+ * Saturated retain counts are rare, so each stripe is just a small array
+ * that is searched linearly.
+ */
+struct objc_retain_count_stripe {
+	objc_rw_lock lock;
+	struct objc_retain_count_entry *entries;
+	unsigned int count;
+	unsigned int capacity;
+};
+
+static struct objc_retain_count_stripe
+				objc_retain_count_stripes[OBJC_RETAIN_COUNT_STRIPES];
+
+static inline struct objc_retain_count_stripe *
+_objc_retain_count_stripe_for_object(id obj)
+{
+	unsigned int index = objc_hash_pointer(obj) % OBJC_RETAIN_COUNT_STRIPES;
+	return &objc_retain_count_stripes[index];
+}
+
+static struct objc_retain_count_entry *
+_objc_retain_count_stripe_find(struct objc_retain_count_stripe *stripe, id obj)
+{
+	for (unsigned int i = 0; i < stripe->count; ++i){
+		if (stripe->entries[i].object == obj){
+			return &stripe->entries[i];
+		}
+	}
+	return NULL;
+}
+
+static struct objc_retain_count_entry *
+_objc_retain_count_stripe_insert(struct objc_retain_count_stripe *stripe,
+				 id obj)
+{
+	if (stripe->count == stripe->capacity){
+		unsigned int capacity = stripe->capacity == 0 ? 4 :
+							stripe->capacity * 2;
+		stripe->entries = objc_realloc(stripe->entries, capacity *
+				sizeof(struct objc_retain_count_entry),
+				M_RETAIN_COUNT_TYPE);
+		stripe->capacity = capacity;
+	}
+	
+	struct objc_retain_count_entry *entry = &stripe->entries[stripe->count];
+	++stripe->count;
+	entry->object = obj;
+	entry->count = 0;
+	return entry;
+}
+
+PRIVATE void
+objc_retain_count_side_table_increment(id obj)
+{
+	objc_retain_count *count =
+			&((struct objc_refcounted_object *)obj)->retain_count;
+	struct objc_retain_count_stripe *stripe =
+			_objc_retain_count_stripe_for_object(obj);
+	
+	/*
+	 * The saturated inline count is only ever changed with the stripe lock
+	 * held, so once we hold it, it's either still saturated, or it has been
+	 * released in the meantime and we can go through the fast path again.
+	 */
+	OBJC_LOCK(&stripe->lock);
+	if (*count != OBJC_RETAIN_COUNT_MAX){
+		OBJC_UNLOCK(&stripe->lock);
+		objc_retain_count_increment(obj);
+		return;
+	}
+	
+	struct objc_retain_count_entry *entry =
+			_objc_retain_count_stripe_find(stripe, obj);
+	if (entry == NULL){
+		entry = _objc_retain_count_stripe_insert(stripe, obj);
+	}
+	++entry->count;
+	OBJC_UNLOCK(&stripe->lock);
+}
+
+PRIVATE objc_retain_count
+objc_retain_count_side_table_decrement(id obj)
+{
+	objc_retain_count *count =
+			&((struct objc_refcounted_object *)obj)->retain_count;
+	struct objc_retain_count_stripe *stripe =
+			_objc_retain_count_stripe_for_object(obj);
+	
+	OBJC_LOCK(&stripe->lock);
+	if (*count != OBJC_RETAIN_COUNT_MAX){
+		OBJC_UNLOCK(&stripe->lock);
+		return objc_retain_count_decrement(obj);
+	}
+	
+	struct objc_retain_count_entry *entry =
+			_objc_retain_count_stripe_find(stripe, obj);
+	if (entry == NULL){
+		/* Nothing in the side table, desaturate the inline count. */
+		__sync_val_compare_and_swap(count, OBJC_RETAIN_COUNT_MAX,
+					    OBJC_RETAIN_COUNT_MAX - 1);
+		OBJC_UNLOCK(&stripe->lock);
+		return OBJC_RETAIN_COUNT_MAX - 1;
+	}
+	
+	if (--entry->count == 0){
+		/* Move the last entry in place of this one. */
+		--stripe->count;
+		*entry = stripe->entries[stripe->count];
+	}
+	OBJC_UNLOCK(&stripe->lock);
+	return OBJC_RETAIN_COUNT_MAX;
+}
+
+PRIVATE void
+objc_retain_count_init(void)
+{
+	for (int i = 0; i < OBJC_RETAIN_COUNT_STRIPES; ++i){
+		objc_rw_lock_init(&objc_retain_count_stripes[i].lock,
+				  "objc_retain_count_stripe_lock");
+	}
+}
+
+PRIVATE void
+objc_retain_count_destroy(void)
+{
+	for (int i = 0; i < OBJC_RETAIN_COUNT_STRIPES; ++i){
+		struct objc_retain_count_stripe *stripe =
+					&objc_retain_count_stripes[i];
+		if (stripe->count != 0){
+			objc_log("%u objects still have saturated retain"
+				 " counts.\n", stripe->count);
+		}
+		if (stripe->entries != NULL){
+			objc_dealloc(stripe->entries, M_RETAIN_COUNT_TYPE);
+			stripe->entries = NULL;
+		}
+		stripe->count = stripe->capacity = 0;
+		objc_rw_lock_destroy(&stripe->lock);
+	}
+}
@@ -0,0 +1,115 @@
+/*
+ * Retain count management of objects that keep the retain count inline,
+ * directly after the isa pointer, as KKObject does.
+ *
+ * The inline count holds the number of retains beyond the first one, the
+ * object is being deallocated once it drops below zero. A negative count is
+ * final - objc_retain_count_try_increment() refuses to retain such objects. When the inline count
+ * reaches OBJC_RETAIN_COUNT_MAX, it saturates and the retains above that are
+ * counted in a striped side table instead. This makes the retain count safe
+ * against overflows, and allows the inline count to be small (see
+ * OBJC_SMALL_RETAIN_COUNT in kernobjc/types.h).
+ */
+
+#ifndef OBJC_REFCOUNT_H_
+#define OBJC_REFCOUNT_H_
+
+/* Number of independently locked parts of the side table. */
+#define OBJC_RETAIN_COUNT_STRIPES 16
+
+struct objc_refcounted_object {
+	Class isa;
+	objc_retain_count retain_count;
+};
+
+/*
+ * Slow paths, for when the inline retain count is saturated. Decrementing
+ * returns the inline retain count after the release.
+ */
+PRIVATE void			objc_retain_count_side_table_increment(id obj);
+PRIVATE objc_retain_count	objc_retain_count_side_table_decrement(id obj);
+
+/*
+ * Retains the object.
+ */
+static inline void
+objc_retain_count_increment(id obj)
+{
+	objc_retain_count *count =
+			&((struct objc_refcounted_object *)obj)->retain_count;
+	objc_retain_count old = *count;
+	while (LIKELY(old < OBJC_RETAIN_COUNT_MAX)){
+		objc_retain_count previous =
+				__sync_val_compare_and_swap(count, old, old + 1);
+		if (LIKELY(previous == old)){
+			return;
+		}
+		old = previous;
+	}
+	
+	objc_retain_count_side_table_increment(obj);
+}
+
+/*
+ * Retains the object unless it is already being deallocated, in which case
+ * NO is returned. Unlike objc_retain_count_increment(), this never brings a
+ * negative retain count back to zero, which would resurrect an object whose
+ * deallocation has already begun.
+ */
+static inline BOOL
+objc_retain_count_try_increment(id obj)
+{
+	objc_retain_count *count =
+			&((struct objc_refcounted_object *)obj)->retain_count;
+	objc_retain_count old = *count;
+	while (LIKELY(old < OBJC_RETAIN_COUNT_MAX)){
+		if (UNLIKELY(old < 0)){
+			return NO;
+		}
+		
+		objc_retain_count previous =
+				__sync_val_compare_and_swap(count, old, old + 1);
+		if (LIKELY(previous == old)){
+			return YES;
+		}
+		old = previous;
+	}
+	
+	objc_retain_count_side_table_increment(obj);
+	return YES;
+}
+
+/*
+ * Releases the object and returns the new inline retain count. The object
+ * needs to be deallocated when the result is -1. Anything lower means that
+ * the object has been over-released.
+ */
+static inline objc_retain_count
+objc_retain_count_decrement(id obj)
+{
+	objc_retain_count *count =
+			&((struct objc_refcounted_object *)obj)->retain_count;
+	objc_retain_count old = *count;
+	while (LIKELY(old < OBJC_RETAIN_COUNT_MAX)){
+		objc_retain_count previous =
+				__sync_val_compare_and_swap(count, old, old - 1);
+		if (LIKELY(previous == old)){
+			return old - 1;
+		}
+		old = previous;
+	}
+	
+	return objc_retain_count_side_table_decrement(obj);
+}
+
+/*
+ * Returns YES if the object's retain count dropped below zero, i.e. the
+ * object is being deallocated.
+ */
+static inline BOOL
+objc_retain_count_is_deallocating(id obj)
+{
+	return ((struct objc_refcounted_object *)obj)->retain_count < 0;
+}
+
+#endif /* !OBJC_REFCOUNT_H_ */
@@ -32,6 +32,9 @@ void objc_runtime_init(void) {
 	objc_selector_init();
 	objc_dispatch_tables_init();
 	objc_class_init();
+	objc_retain_count_init();
+	objc_weak_table_init();
+	objc_sync_init();
 	objc_arc_init();
 	objc_protocol_init();
 	objc_associated_objects_init();
@@ -64,6 +67,9 @@ void	objc_runtime_destroy(void) {
 	objc_protocol_destroy();
 	objc_dispatch_tables_destroy();
 	objc_arc_destroy();
+	objc_retain_count_destroy();
+	objc_weak_table_destroy();
+	objc_sync_destroy();
 	objc_associated_objects_destroy();
 	objc_exceptions_destroy();
 	objc_blocks_destroy();
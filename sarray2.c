@@ -58,8 +58,59 @@ PRIVATE SparseArray * SparseArrayNewWithDepth(uint16_t depth)
 
 PRIVATE SparseArray *SparseArrayNew(void)
 {
-	return SparseArrayNewWithDepth(16);
+	return SparseArrayNewWithDepth(SARRAY_DEPTH);
 }
+static SparseArrayCompactData *
+SparseArrayCompactDataNew(SparseArray *parent, uint16_t count)
+{
+	SparseArrayCompactData *data =
+		objc_zero_alloc(sizeof(SparseArrayCompactData) +
+						count * sizeof(SparseArrayCompactEntry),
+						M_SPARSE_ARRAY_TYPE);
+	data->parent = parent;
+	data->count = count;
+	return data;
+}
+
+PRIVATE SparseArray *SparseArrayNewCompact(SparseArray *parent)
+{
+	SparseArray * sarray = objc_zero_alloc(sizeof(SparseArray),
+					       M_SPARSE_ARRAY_TYPE);
+	sarray->refCount = 1;
+	sarray->shift = SARRAY_COMPACT_SHIFT;
+	sarray->data = (void**)SparseArrayCompactDataNew(parent, 0);
+	return sarray;
+}
+
+static void SparseArrayCompactInsert(SparseArray * sarray, SparseArrayIndex index,
+                                     void *value)
+{
+	SparseArrayCompactData *old = (SparseArrayCompactData*)sarray->data;
+	uint16_t i = 0;
+	while (i < old->count && old->entries[i].index < index)
+	{
+		i++;
+	}
+	if (i < old->count && old->entries[i].index == index)
+	{
+		// Replacing a pointer is atomic, the vector can stay.
+		old->entries[i].value = value;
+		return;
+	}
+
+	SparseArrayCompactData *new = SparseArrayCompactDataNew(old->parent,
+	                                                        old->count + 1);
+	memcpy(new->entries, old->entries, i * sizeof(SparseArrayCompactEntry));
+	new->entries[i].index = index;
+	new->entries[i].value = value;
+	memcpy(&new->entries[i + 1], &old->entries[i],
+	       (old->count - i) * sizeof(SparseArrayCompactEntry));
+	new->retired = old;
+	// Make sure the vector is filled in before other threads can see it.
+	__sync_synchronize();
+	sarray->data = (void**)new;
+}
+
 PRIVATE SparseArray *SparseArrayExpandingArray(SparseArray *sarray,
 					       uint16_t new_depth)
 {
@@ -93,7 +144,7 @@ PRIVATE SparseArray *SparseArrayExpandingArray(SparseArray *sarray,
 	return sarray;
 }
 
-static void *SparseArrayFind(SparseArray * sarray, uint16_t * index)
+static void *SparseArrayFind(SparseArray * sarray, SparseArrayIndex * index)
 {
 	uint16_t j = MASK_INDEX((*index));
 	uint16_t max = MAX_INDEX(sarray);
@@ -109,12 +160,13 @@ static void *SparseArrayFind(SparseArray * sarray, uint16_t * index)
 			j++;
 		}
 	}
-	else while (j<max)
+	else
 	{
 		// If the shift is not 0, then we need to recursively look at child
 		// nodes.
-		uint16_t zeromask = ~(sarray->mask >> base_shift);
-		while (j<max)
+		SparseArrayIndex zeromask =
+			~(SparseArrayIndex)((1 << sarray->shift) - 1);
+		while (j<=max)
 		{
 			//Look in child nodes
 			SparseArray *child = sarray->data[j];
@@ -124,7 +176,8 @@ static void *SparseArrayFind(SparseArray * sarray, uint16_t * index)
 			{
 				//Add 2^n to index so j is still correct
 				(*index) += 1<<sarray->shift;
-				//Zero off the next component of the index so we don't miss any.
+				//Zero off the lower components of the index so we don't miss
+				//any.
 				*index &= zeromask;
 			}
 			else
@@ -144,15 +197,22 @@ static void *SparseArrayFind(SparseArray * sarray, uint16_t * index)
 	return SARRAY_EMPTY;
 }
 
-PRIVATE void *SparseArrayNext(SparseArray * sarray, uint16_t * idx)
+PRIVATE void *SparseArrayNext(SparseArray * sarray, SparseArrayIndex * idx)
 {
+	objc_assert(!SparseArrayIsCompact(sarray),
+				"Iterating a compact sparse array\n");
 	(*idx)++;
 	return SparseArrayFind(sarray, idx);
 }
 
-PRIVATE void SparseArrayInsert(SparseArray * sarray, uint16_t index, void *value)
+PRIVATE void SparseArrayInsert(SparseArray * sarray, SparseArrayIndex index,
+                               void *value)
 {
-	if (sarray->shift > 0)
+	if (SparseArrayIsCompact(sarray))
+	{
+		SparseArrayCompactInsert(sarray, index, value);
+	}
+	else if (sarray->shift > 0)
 	{
 		uint16_t i = MASK_INDEX(index);
 		SparseArray *child = sarray->data[i];
@@ -191,8 +251,61 @@ PRIVATE void SparseArrayInsert(SparseArray * sarray, uint16_t index, void *value
 	}
 }
 
+PRIVATE void SparseArrayInsertShared(SparseArray * sarray, SparseArray * other,
+                                     SparseArrayIndex index, void *value)
+{
+	// Only handle the two-level arrays; leaves of other layouts can't be
+	// shared.
+	if (SparseArrayIsCompact(sarray) || SparseArrayIsCompact(other) ||
+	    sarray->shift != base_shift || other->shift != base_shift)
+	{
+		SparseArrayInsert(sarray, index, value);
+		return;
+	}
+
+	uint16_t i = MASK_INDEX(index);
+	SparseArray *child = sarray->data[i];
+	SparseArray *otherChild = other->data[i];
+	// If the leaf is not shared, it's cheaper to just update it in place.
+	if (child == otherChild || child == &EmptyArray ||
+	    otherChild == &EmptyArray || child->refCount <= 1 ||
+	    otherChild->data[index & base_mask] != value)
+	{
+		SparseArrayInsert(sarray, index, value);
+		return;
+	}
+
+	for (unsigned j = 0 ; j <= base_mask ; j++)
+	{
+		if (j != (index & base_mask) && child->data[j] != otherChild->data[j])
+		{
+			SparseArrayInsert(sarray, index, value);
+			return;
+		}
+	}
+
+	// The leaf would be identical to the other one after the insert, so share
+	// it instead of making a copy.  Since the old leaf is shared, destroying
+	// it only drops the reference count.
+	__sync_fetch_and_add(&otherChild->refCount, 1);
+	sarray->data[i] = otherChild;
+	SparseArrayDestroy(&child);
+}
+
 PRIVATE SparseArray *SparseArrayCopy(SparseArray * sarray)
 {
+	if (SparseArrayIsCompact(sarray))
+	{
+		SparseArrayCompactData *data = (SparseArrayCompactData*)sarray->data;
+		SparseArray *copy = SparseArrayCopy(data->parent);
+		for (uint16_t i = 0 ; i < data->count ; i++)
+		{
+			SparseArrayInsert(copy, data->entries[i].index,
+			                  data->entries[i].value);
+		}
+		return copy;
+	}
+
 	SparseArray *copy = objc_zero_alloc(sizeof(SparseArray),
 					    M_SPARSE_ARRAY_TYPE);
 	copy->refCount = 1;
@@ -225,6 +338,20 @@ PRIVATE void SparseArrayDestroy(SparseArray **sarray)
 		return;
 	}
 
+	if (SparseArrayIsCompact(*sarray))
+	{
+		SparseArrayCompactData *data = (SparseArrayCompactData*)(*sarray)->data;
+		while (data != NULL)
+		{
+			SparseArrayCompactData *retired = data->retired;
+			objc_dealloc(data, M_SPARSE_ARRAY_TYPE);
+			data = retired;
+		}
+		objc_dealloc((*sarray), M_SPARSE_ARRAY_TYPE);
+		*sarray = NULL;
+		return;
+	}
+
 	if((*sarray)->shift > 0)
 	{
 		uint16_t max = ((*sarray)->mask >> (*sarray)->shift) + 1;
@@ -242,6 +369,17 @@ PRIVATE void SparseArrayDestroy(SparseArray **sarray)
 PRIVATE int SparseArraySize(SparseArray *sarray)
 {
 	int size = 0;
+	if (SparseArrayIsCompact(sarray))
+	{
+		size += sizeof(SparseArray);
+		for (SparseArrayCompactData *data = (SparseArrayCompactData*)sarray->data ;
+		     data != NULL ; data = data->retired)
+		{
+			size += sizeof(SparseArrayCompactData) +
+				data->count * sizeof(SparseArrayCompactEntry);
+		}
+		return size;
+	}
 	if (sarray->shift == 0)
 	{
 		return 256*sizeof(void*) + sizeof(SparseArray);
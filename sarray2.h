@@ -20,13 +20,28 @@
  * own locking).  For this reason, you should be very careful when deleting a
  * sparse array that there are no references to it held by other threads.
  */
+
+/*
+ * Indexes are selectors, which are 16-bit, so two levels with 8-bit leaves
+ * are enough.  With OBJC_LARGE_SELECTORS, they are 24-bit and the arrays have
+ * three levels.
+ */
+#if OBJC_LARGE_SELECTORS
+typedef uint32_t SparseArrayIndex;
+#else
+typedef uint16_t SparseArrayIndex;
+#endif
+#define SARRAY_DEPTH OBJC_SELECTOR_BITS
+/* Shift of the root node of SparseArrayNew() arrays. */
+#define SARRAY_ROOT_SHIFT (SARRAY_DEPTH - 8)
+
 typedef struct 
 {
 	/*
 	 * Mask value applied to the index when generating an index in this
 	 * sub-array.
 	 */
-	uint16_t mask;
+	SparseArrayIndex mask;
 	/*
 	 * Number of bits that the masked value should be right shifted by to get
 	 * the index in the subarray.  If this value is greater than zero, then the
@@ -46,6 +61,38 @@ typedef struct
 	void ** data;
 } SparseArray;
 
+/*
+ * Value of the shift field marking a compact sparse array.  A compact sparse
+ * array doesn't have the two-level layout - its data points to a
+ * SparseArrayCompactData structure with a sorted vector of index-value pairs
+ * and a parent sparse array that is consulted for indexes that aren't in the
+ * vector.  This is used for dtables of classes that override only a handful of
+ * selectors, which would otherwise pay for a root node and a copied leaf page
+ * for each selector they override.
+ */
+#define SARRAY_COMPACT_SHIFT 0xffff
+
+typedef struct
+{
+	SparseArrayIndex index;
+	void *value;
+} SparseArrayCompactEntry;
+
+typedef struct _SparseArrayCompactData
+{
+	/* The sparse array consulted for indexes missing in this one. */
+	SparseArray *parent;
+	/*
+	 * Vectors are never modified in place once published, inserting a new
+	 * index creates a new vector.  The old ones are kept in this list until
+	 * the sparse array is destroyed, since other threads may still be
+	 * performing lookups in them.
+	 */
+	struct _SparseArrayCompactData *retired;
+	uint16_t count;
+	SparseArrayCompactEntry entries[];
+} SparseArrayCompactData;
+
 /*
  * Turn an index in the array into an index in the current depth.
  */
@@ -53,18 +100,65 @@ typedef struct
 	((index & sarray->mask) >> sarray->shift)
 
 #define SARRAY_EMPTY ((void*)0)
+
+static inline void* SparseArrayLookup(SparseArray * sarray, SparseArrayIndex index);
+
+/*
+ * Binary search in the vector of a compact sparse array, falling back to the
+ * parent.
+ */
+static inline void* SparseArrayCompactLookup(SparseArray * sarray,
+                                             SparseArrayIndex index)
+{
+	SparseArrayCompactData *data = (SparseArrayCompactData*)sarray->data;
+	int low = 0;
+	int high = (int)data->count - 1;
+	while (low <= high)
+	{
+		int mid = (low + high) / 2;
+		SparseArrayIndex midIndex = data->entries[mid].index;
+		if (midIndex == index)
+		{
+			return data->entries[mid].value;
+		}
+		if (midIndex < index)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid - 1;
+		}
+	}
+	return SparseArrayLookup(data->parent, index);
+}
+
 /*
  * Look up the specified value in the sparse array.  This is used in message
  * dispatch and so has been put in the header to allow compilers to inline it,
  * even though this breaks the abstraction.
  */
-static inline void* SparseArrayLookup(SparseArray * sarray, uint16_t index)
+static inline void* SparseArrayLookup(SparseArray * sarray, SparseArrayIndex index)
 {
 	// This unrolled version of the commented-out segment below only works with
 	// sarrays that use one-byte leaves.  It's really ugly, but seems to be faster.
 	// With this version, we get the same performance as the old GNU code, but
 	// with about half the memory usage.
-	uint16_t i = index;
+	SparseArrayIndex i = index;
+	// Check for the layout of the dtables first, only fall back to the
+	// switch for the other ones.
+	if (LIKELY(sarray->shift == SARRAY_ROOT_SHIFT))
+	{
+#if OBJC_LARGE_SELECTORS
+		return
+			((SparseArray*)((SparseArray*)
+				sarray->data[(i & 0xff0000)>>16])->
+					data[(i & 0xff00)>>8])->data[(i & 0xff)];
+#else
+		return 
+			((SparseArray*)sarray->data[(i & 0xff00)>>8])->data[(i & 0xff)];
+#endif
+	}
 	switch (sarray->shift)
 	{
 		default: UNREACHABLE("broken sarray");
@@ -78,6 +172,8 @@ static inline void* SparseArrayLookup(SparseArray * sarray, uint16_t index)
 				((SparseArray*)((SparseArray*)
 					sarray->data[(i & 0xff0000)>>16])->
 						data[(i & 0xff00)>>8])->data[(i & 0xff)];
+		case SARRAY_COMPACT_SHIFT:
+			return SparseArrayCompactLookup(sarray, i);
 	}
 }
 /*
@@ -90,6 +186,19 @@ PRIVATE SparseArray *SparseArrayNew(void);
  * should ideally be a multiple of base_shift.
  */
 PRIVATE SparseArray *SparseArrayNewWithDepth(uint16_t depth);
+/*
+ * Creates a new compact sparse array, which returns values from the parent for
+ * all indexes that weren't inserted into it.  The parent must outlive the
+ * compact array.  Compact arrays can't be iterated with SparseArrayNext().
+ */
+PRIVATE SparseArray *SparseArrayNewCompact(SparseArray *parent);
+/*
+ * Returns whether the sparse array is a compact one.
+ */
+static inline BOOL SparseArrayIsCompact(SparseArray *sarray)
+{
+	return sarray->shift == SARRAY_COMPACT_SHIFT;
+}
 /*
  * Returns a new sparse array created by adding this one as the first child
  * node in an expanded one.
@@ -98,7 +207,16 @@ PRIVATE SparseArray *SparseArrayExpandingArray(SparseArray *sarray, uint16_t new
 /*
  * Insert a value at the specified index.
  */
-PRIVATE void SparseArrayInsert(SparseArray * sarray, uint16_t index, void * value);
+PRIVATE void SparseArrayInsert(SparseArray * sarray, SparseArrayIndex index, void * value);
+/*
+ * Insert a value at the specified index.  If the leaf node containing the index
+ * is shared copy-on-write and would become identical to the corresponding leaf
+ * of the other sparse array, the other array's leaf is shared instead of
+ * making a copy.  Used to keep subclass dtables sharing leaves with the
+ * superclass's dtable.
+ */
+PRIVATE void SparseArrayInsertShared(SparseArray * sarray, SparseArray * other,
+                                     SparseArrayIndex index, void * value);
 /*
  * Destroy the sparse array.  Note that calling this while other threads are
  * performing lookups is guaranteed to break.
@@ -111,15 +229,17 @@ PRIVATE void SparseArrayDestroy(SparseArray **sarray);
  * and set index to 1.  A subsequent call with index set to 1 will return the
  * value at 10 and set index to 11.
  */
-PRIVATE void * SparseArrayNext(SparseArray * sarray, uint16_t * index);
+PRIVATE void * SparseArrayNext(SparseArray * sarray, SparseArrayIndex * index);
 
 /*
- * Creates a copy of the sparse array.
+ * Creates a copy of the sparse array.  Copying a compact sparse array creates
+ * a regular one, with the inserted values merged with the parent's.
  */
 PRIVATE SparseArray *SparseArrayCopy(SparseArray * sarray);
 
 /*
- * Returns the total memory usage of a sparse array.  
+ * Returns the total memory usage of a sparse array.  For compact sparse arrays,
+ * only the memory used by the array itself is counted, not the parent's.
  */
 PRIVATE int SparseArraySize(SparseArray *sarray);
 
@@ -21,7 +21,7 @@
 #pragma mark STATIC_VARIABLES_AND_MACROS
 
 /*
- * The initial capacity for the hash table.
+ * The initial capacity for the hash table, must be a power of two.
  */
 #define OBJC_SELECTOR_TABLE_INITIAL_CAPACITY ((uint32_t)1024)
 
@@ -38,152 +38,367 @@ PRIVATE SEL objc_initialize_selector = null_selector;
 PRIVATE SEL objc_is_arc_compatible_selector = null_selector;
 
 
-/* Forward declarations needed for the hash table */
-static inline BOOL _objc_selector_struct_name_is_equal_to(void *key,
-						struct objc_selector *sel);
-static inline uint32_t _objc_selector_hash(struct objc_selector *sel);
-
-#define MAP_TABLE_NAME objc_selector
-#define MAP_TABLE_COMPARE_FUNCTION _objc_selector_struct_name_is_equal_to
-#define MAP_TABLE_HASH_KEY objc_hash_string
-#define MAP_TABLE_HASH_VALUE _objc_selector_hash
-#define MAP_TABLE_VALUE_TYPE struct objc_selector *
-#define MAP_TABLE_NO_LOCK 1
-#define MAP_MALLOC_TYPE M_SELECTOR_MAP_TYPE
-#define SELECTOR
-
-#include "hashtable.h"
+/*
+ * The name -> selector table.
+ *
+ * Lookups (sel_getNamed(), sel_registerName() of an already registered
+ * selector, ...) never lock. The table is open-addressed with linear probing
+ * and selectors are never moved nor removed, so a reader walking the table
+ * finds every selector that had been in it when the reader loaded the table
+ * pointer. When the table needs to grow, a new table is filled and published
+ * with a single pointer store. The old table is kept, since some reader may
+ * still be walking it - there is no grace period tracking in the run-time, so
+ * the retired tables are freed in objc_selector_destroy(). As the table
+ * doubles on each resize, all of them take less memory than the current one.
+ *
+ * Inserts serialize on objc_selector_lock.
+ */
+struct objc_selector_table {
+	/* Number of cells, a power of two. */
+	uint32_t size;
+	
+	/* Number of occupied cells. */
+	uint32_t used;
+	
+	/* Next retired table. */
+	struct objc_selector_table *retired_next;
+	
+	struct objc_selector *cells[];
+};
 
 
-/* 
- * String allocator stuff.
+/*
+ * String arena.
  *
- * We allocate a page from which we bite a selector name at a time. We assume
- * 512 pages is enough, though they aren't allocated all at once! We just need
- * to be able to release these pages when the module is unloaded.
+ * Selector names and types are bitten out of chunks that are never freed
+ * until the run-time is destroyed. The arena grows without limit - strings
+ * that don't fit into a chunk get a chunk of their own.
  *
- * NOTE: This number is based on the many-selectors-test which allocates nearly
- * 62,000 selectors of length 16, which is way much more than the actual usage
- * will ever be.
+ * Rather than throwing away the tail of a chunk as soon as a string doesn't
+ * fit in it, the arena keeps a few chunks open and small strings are packed
+ * into their tails. Only when an open chunk gets replaced, its tail is lost
+ * and is accounted as wasted.
+ *
+ * Type strings are deduplicated, since many selectors share them.
+ *
+ * All of this requires objc_selector_lock to be locked.
  */
-#define STRING_ALLOCATOR_MAX_PAGES 384
+#define OBJC_SELECTOR_ARENA_CHUNK_SIZE PAGE_SIZE
+#define OBJC_SELECTOR_ARENA_OPEN_CHUNKS 4
+
+/* Must be a power of two. */
+#define OBJC_SELECTOR_TYPES_TABLE_INITIAL_CAPACITY ((uint32_t)64)
 
-/* Points to the next index in string_allocator_pages. */
-static unsigned short string_allocator_next_page_index = 0;
+struct objc_selector_arena_chunk {
+	struct objc_selector_arena_chunk *next;
+	
+	/* Size of the data and number of bytes used. */
+	size_t size;
+	size_t used;
+	
+	char data[];
+};
 
-/* Pointers to the pages allocated. */
-static void *string_allocator_pages[STRING_ALLOCATOR_MAX_PAGES];
+static struct objc_selector_arena_chunk *objc_selector_arena_chunks;
+static struct objc_selector_arena_chunk
+			*objc_selector_arena_open_chunks[OBJC_SELECTOR_ARENA_OPEN_CHUNKS];
 
-/* Points to the address currently used for the next string. */
-static char *string_allocator = NULL;
+/* Interned type strings, open-addressed with linear probing. */
+static const char **objc_selector_types_table;
+static uint32_t objc_selector_types_table_size;
+static uint32_t objc_selector_types_table_used;
 
-/* Bytes remaining on current page. */
-static size_t string_allocator_bytes_remaining = 0;
+PRIVATE struct objc_selector_arena_statistics objc_selector_arena_statistics;
 
 static objc_rw_lock objc_selector_lock;
 
-struct objc_selector_table_struct *objc_selector_hashtable;
+static struct objc_selector_table * volatile objc_selector_hashtable;
+static struct objc_selector_table *objc_selector_retired_tables;
 static SparseArray *objc_selector_sparse;
 
 
 #pragma mark -
 #pragma mark PRIVATE_FUNCTIONS
 
+static struct objc_selector_table *
+_objc_selector_table_create(uint32_t size)
+{
+	struct objc_selector_table *table;
+	table = objc_zero_alloc(sizeof(struct objc_selector_table)
+				+ size * sizeof(struct objc_selector *),
+				M_SELECTOR_MAP_TYPE);
+	table->size = size;
+	return table;
+}
+
+/*
+ * Looks up the selector with name, hash must be objc_hash_string(name).
+ *
+ * No locking necessary.
+ */
+static inline struct objc_selector *
+_objc_selector_table_get(const char *name, uint32_t hash)
+{
+	struct objc_selector_table *table = objc_selector_hashtable;
+	uint32_t mask = table->size - 1;
+	
+	/* The table is never full, so there's always a NULL cell to stop at. */
+	for (uint32_t i = hash & mask; ; i = (i + 1) & mask){
+		struct objc_selector *selector =
+			((struct objc_selector * volatile *)table->cells)[i];
+		if (selector == NULL){
+			return NULL;
+		}
+		if (selector->hash == hash
+		    && objc_strings_equal(selector->name, name)){
+			return selector;
+		}
+	}
+}
+
 /*
- * Returns YES if both selector structures are equal
- * based on string comparison of names.
+ * Inserts the selector into the table, which must have room for it.
+ *
+ * Requires objc_selector_lock to be locked.
  */
-static inline BOOL
-_objc_selector_struct_name_is_equal_to(void *key, struct objc_selector *sel)
+static void
+_objc_selector_table_insert_no_lock(struct objc_selector_table *table,
+				    struct objc_selector *selector)
 {
-	return objc_strings_equal(sel->name, (const char*)key);
+	uint32_t mask = table->size - 1;
+	uint32_t i = selector->hash & mask;
+	while (table->cells[i] != NULL){
+		i = (i + 1) & mask;
+	}
+	
+	/* Readers must never see a partially initialized selector. */
+	__sync_synchronize();
+	((struct objc_selector * volatile *)table->cells)[i] = selector;
+	++table->used;
 }
 
 /*
- * Hashes the selector using its name field.
+ * Makes sure count more selectors fit into the table while keeping it at
+ * most 75% full, publishing a larger table if needed.
+ *
+ * Requires objc_selector_lock to be locked.
  */
-static inline uint32_t
-_objc_selector_hash(struct objc_selector *sel)
+static void
+_objc_selector_table_reserve_no_lock(uint32_t count)
 {
-	objc_assert(sel != NULL, "Can't hash NULL selector!");
-	return objc_hash_string(sel->name);
+	struct objc_selector_table *table = objc_selector_hashtable;
+	uint64_t needed = ((uint64_t)table->used + count) * 4;
+	uint32_t size = table->size;
+	while (needed > (uint64_t)size * 3){
+		size *= 2;
+	}
+	
+	if (size == table->size){
+		return;
+	}
+	
+	struct objc_selector_table *new_table = _objc_selector_table_create(size);
+	for (uint32_t i = 0; i < table->size; ++i){
+		if (table->cells[i] != NULL){
+			_objc_selector_table_insert_no_lock(new_table,
+							    table->cells[i]);
+		}
+	}
+	
+	__sync_synchronize();
+	objc_selector_hashtable = new_table;
+	
+	table->retired_next = objc_selector_retired_tables;
+	objc_selector_retired_tables = table;
 }
 
 static inline const char *
 _objc_selector_get_types(struct objc_selector *sel)
 {
-	return sel->name + objc_strlen(sel->name) + 1;
+	return sel->types;
+}
+
+static inline size_t
+_objc_selector_arena_chunk_remaining(struct objc_selector_arena_chunk *chunk)
+{
+	return chunk->size - chunk->used;
+}
+
+static struct objc_selector_arena_chunk *
+_objc_selector_arena_new_chunk(size_t size)
+{
+	struct objc_selector_arena_chunk *chunk;
+	chunk = objc_alloc(sizeof(struct objc_selector_arena_chunk) + size,
+			   M_SELECTOR_NAME_TYPE);
+	if (chunk == NULL){
+		return NULL;
+	}
+	
+	chunk->size = size;
+	chunk->used = 0;
+	chunk->next = objc_selector_arena_chunks;
+	objc_selector_arena_chunks = chunk;
+	
+	objc_selector_arena_statistics.chunk_count += 1;
+	objc_selector_arena_statistics.bytes_allocated += size;
+	return chunk;
 }
 
 /*
- * Uses direct page allocation for string allocation.
+ * Picks the open chunk for a string of size bytes, opening a new chunk if
+ * the string doesn't fit into any of them.
  *
  * Requires objc_selector_lock to be locked.
  */
-static char *
-_objc_selector_allocate_string(size_t size)
+static struct objc_selector_arena_chunk *
+_objc_selector_arena_chunk_for_size(size_t size)
 {
+	const size_t chunk_size = OBJC_SELECTOR_ARENA_CHUNK_SIZE
+				- sizeof(struct objc_selector_arena_chunk);
+	
+	/* Strings this long would just push other chunks out. */
+	if (size > chunk_size / 2){
+		return _objc_selector_arena_new_chunk(size);
+	}
+	
 	/*
-	 * No locking necessary, since this gets called
-	 * only from places, where the objc_selector_lock
-	 * is already locked.
+	 * Use the fullest open chunk the string fits into, keeping roomier
+	 * chunks for longer strings. The emptiest slot (or the chunk with the
+	 * shortest tail) gets replaced if a new chunk is needed.
 	 */
-	
-	if (string_allocator_bytes_remaining < size){
-		/*
-		 * This means that we need more bytes than are left
-		 * on that page.
-		 *
-		 * We of course could keep pointer to the old page,
-		 * and try to fill the remaining few bytes, but it will 
-		 * be most often just a really few bytes since the selector
-		 * and type strings are usually quite small.
-		 *
-		 * This also covers the string_allocator == NULL case.
-		 */
-		
-		objc_assert(string_allocator_next_page_index
-			    < STRING_ALLOCATOR_MAX_PAGES,
-			    "Too many custom selectors allocated. Increase the "
-			    "STRING_ALLOCATOR_MAX_PAGES number in selector.c.\n");
-		
-		string_allocator = objc_zero_alloc(PAGE_SIZE, M_SELECTOR_NAME_TYPE);
-		objc_debug_log("Allocated page at address %p\n", string_allocator);
-		
-		string_allocator_bytes_remaining = PAGE_SIZE;
-		string_allocator_pages[string_allocator_next_page_index] =
-														string_allocator;
-		++string_allocator_next_page_index;
+	struct objc_selector_arena_chunk *best = NULL;
+	int victim = 0;
+	for (int i = 0; i < OBJC_SELECTOR_ARENA_OPEN_CHUNKS; ++i){
+		struct objc_selector_arena_chunk *chunk =
+					objc_selector_arena_open_chunks[i];
+		struct objc_selector_arena_chunk *victim_chunk =
+					objc_selector_arena_open_chunks[victim];
+		if (chunk == NULL){
+			if (victim_chunk != NULL){
+				victim = i;
+			}
+			continue;
+		}
 		
-		if (string_allocator == NULL){
-			return NULL;
+		size_t remaining = _objc_selector_arena_chunk_remaining(chunk);
+		if (remaining >= size && (best == NULL
+			|| remaining < _objc_selector_arena_chunk_remaining(best))){
+			best = chunk;
+		}
+		if (victim_chunk != NULL && remaining
+			< _objc_selector_arena_chunk_remaining(victim_chunk)){
+			victim = i;
 		}
 	}
 	
-	char *result = string_allocator;
-	string_allocator += size;
-	string_allocator_bytes_remaining -= size;
+	if (best != NULL){
+		return best;
+	}
 	
-	return result;
+	struct objc_selector_arena_chunk *chunk =
+				_objc_selector_arena_new_chunk(chunk_size);
+	if (chunk == NULL){
+		return NULL;
+	}
+	
+	struct objc_selector_arena_chunk *old_chunk =
+				objc_selector_arena_open_chunks[victim];
+	if (old_chunk != NULL){
+		objc_selector_arena_statistics.bytes_wasted +=
+				_objc_selector_arena_chunk_remaining(old_chunk);
+	}
+	objc_selector_arena_open_chunks[victim] = chunk;
+	return chunk;
 }
 
 /*
- * Creates a new string including both name and types
- * and copies both strings over.
+ * Allocates size bytes from the arena.
  *
  * Requires objc_selector_lock to be locked.
  */
 static char *
-_objc_selector_copy_name_and_types(const char *name, const char *types)
+_objc_selector_allocate_string(size_t size)
 {
-	size_t name_size = objc_strlen(name);
-	size_t types_size = objc_strlen(types);
-	size_t size = name_size + types_size + 2; /* +2 for two \0 */
+	struct objc_selector_arena_chunk *chunk;
+	chunk = _objc_selector_arena_chunk_for_size(size);
+	if (chunk == NULL){
+		return NULL;
+	}
+	
+	char *result = chunk->data + chunk->used;
+	chunk->used += size;
+	objc_selector_arena_statistics.bytes_used += size;
 	
+	return result;
+}
+
+/*
+ * Copies the string into the arena.
+ *
+ * Requires objc_selector_lock to be locked.
+ */
+static char *
+_objc_selector_copy_string(const char *str)
+{
+	size_t size = objc_strlen(str) + 1;
 	char *result = _objc_selector_allocate_string(size);
+	if (result != NULL){
+		memcpy(result, str, size);
+	}
+	return result;
+}
+
+/*
+ * Returns the interned copy of types, copying them into the arena if they
+ * haven't been seen yet.
+ *
+ * Requires objc_selector_lock to be locked.
+ */
+static const char *
+_objc_selector_intern_types(const char *types)
+{
+	uint32_t hash = objc_hash_string(types);
+	uint32_t mask = objc_selector_types_table_size - 1;
+	uint32_t i;
+	for (i = hash & mask; objc_selector_types_table[i] != NULL;
+	     i = (i + 1) & mask){
+		if (objc_strings_equal(objc_selector_types_table[i], types)){
+			objc_selector_arena_statistics.types_deduplicated += 1;
+			return objc_selector_types_table[i];
+		}
+	}
 	
-	memcpy(result, name, name_size + 1);
-	memcpy(result + name_size + 1, types, types_size + 1);
+	const char *result = _objc_selector_copy_string(types);
+	if (result == NULL){
+		return NULL;
+	}
+	
+	objc_selector_types_table[i] = result;
+	++objc_selector_types_table_used;
+	
+	/* Keep the table at most 75% full. */
+	if (objc_selector_types_table_used * 4
+	    > objc_selector_types_table_size * 3){
+		uint32_t new_size = objc_selector_types_table_size * 2;
+		const char **new_table = objc_zero_alloc(new_size * sizeof(char *),
+							 M_SELECTOR_MAP_TYPE);
+		for (uint32_t j = 0; j < objc_selector_types_table_size; ++j){
+			const char *entry = objc_selector_types_table[j];
+			if (entry == NULL){
+				continue;
+			}
+			
+			uint32_t k = objc_hash_string(entry) & (new_size - 1);
+			while (new_table[k] != NULL){
+				k = (k + 1) & (new_size - 1);
+			}
+			new_table[k] = entry;
+		}
+		
+		objc_dealloc(objc_selector_types_table, M_SELECTOR_MAP_TYPE);
+		objc_selector_types_table = new_table;
+		objc_selector_types_table_size = new_size;
+	}
 	
 	return result;
 }
@@ -193,6 +408,9 @@ _sel_allocate_sel_uid(void)
 {
   static int objc_selector_counter = 1;
 	int original_value = __sync_fetch_and_add(&objc_selector_counter, 1);
+	objc_assert(original_value < (1 << OBJC_SELECTOR_BITS),
+		    "Too many selectors registered. Build the run-time with"
+		    " OBJC_LARGE_SELECTORS to allow for more.\n");
 	return original_value;
 }
 
@@ -212,8 +430,7 @@ sel_registerName_direct(struct objc_selector *selector)
 	}
 	
 	struct objc_selector *registered_sel;
-	registered_sel = objc_selector_table_get(objc_selector_hashtable,
-						 selector->name);
+	registered_sel = _objc_selector_table_get(selector->name, selector->hash);
 	if (registered_sel != NULL){
 		/* Just update the information in the original selector */
 		selector->name = registered_sel->name;
@@ -223,25 +440,33 @@ sel_registerName_direct(struct objc_selector *selector)
 	
 	selector->sel_uid = _sel_allocate_sel_uid();
 	
-	if (objc_selector_insert(objc_selector_hashtable, selector) == 0){
-		objc_log("Failed to insert selector %s!\n", selector->name);
-		return NO;
-	}
-	
 	//objc_debug_log("Registering selector %s to sel_uid %d.\n",
 	//	       selector->name, selector->sel_uid);
 	
+	/*
+	 * Lock-free readers may call sel_getTypes() on the SEL as soon as they
+	 * find the selector in the table, so insert it into the sparse array
+	 * first.
+	 */
 	SparseArrayInsert(objc_selector_sparse, selector->sel_uid, selector);
 	
+	_objc_selector_table_reserve_no_lock(1);
+	_objc_selector_table_insert_no_lock(objc_selector_hashtable, selector);
+	
 	return YES;
 }
 
+/*
+ * Registers the selector, hash must be objc_hash_string(name).
+ *
+ * Requires objc_selector_lock to be locked.
+ */
 static inline SEL
-_sel_register_name_no_lock(const char *name, const char *types)
+_sel_register_hashed_name_no_lock(const char *name, const char *types,
+				  uint32_t hash)
 {
 	struct objc_selector *selector;
-	selector = objc_selector_table_get(objc_selector_hashtable,
-					   name);
+	selector = _objc_selector_table_get(name, hash);
 	if (selector == NULL){
 		/*
 		 * Still NULL -> no other thread inserted it
@@ -249,14 +474,16 @@ _sel_register_name_no_lock(const char *name, const char *types)
 		 */
 		
 		selector = objc_alloc(sizeof(struct objc_selector), M_SELECTOR_TYPE);
-		selector->name =
-		_objc_selector_copy_name_and_types(name, types);
+		selector->name = _objc_selector_copy_string(name);
+		selector->types = _objc_selector_intern_types(types);
 		
 		/* Will be populated when registered */
 		selector->sel_uid = null_selector;
+		selector->hash = hash;
 		
-		if (selector->name == NULL){
+		if (selector->name == NULL || selector->types == NULL){
 			/* Probably ran out of memory */
+			objc_dealloc(selector, M_SELECTOR_TYPE);
 			return null_selector;
 		}
 		
@@ -273,10 +500,50 @@ _sel_register_name_no_lock(const char *name, const char *types)
 	return selector->sel_uid;
 }
 
-static inline void
-_sel_register_from_method_list_no_lock(objc_method_list *list)
+static inline SEL
+_sel_register_name_no_lock(const char *name, const char *types)
+{
+	return _sel_register_hashed_name_no_lock(name, types,
+						 objc_hash_string(name));
+}
+
+/*
+ * Looks up SELs of the methods in the list without locking. Returns the index
+ * of the first method whose selector hasn't been registered yet, or the list
+ * size if all selectors have been found.
+ */
+static inline int
+_sel_lookup_from_method_list(objc_method_list *list)
 {
 	for (int i = 0; i < list->size; ++i){
+		Method m = &list->list[i];
+		struct objc_selector *selector;
+		selector = _objc_selector_table_get(m->selector_name,
+						    objc_hash_string(m->selector_name));
+		if (selector == NULL){
+			return i;
+		}
+		
+		objc_assert(objc_strings_equal(m->selector_types,
+					_objc_selector_get_types(selector)),
+			    "Registering selector %s for the second time with"
+			    " different types [%s vs %s]!\n", m->selector_name,
+			    _objc_selector_get_types(selector),
+			    m->selector_types);
+		m->selector = selector->sel_uid;
+	}
+	return list->size;
+}
+
+/*
+ * Registers selectors of the methods in the list, starting at index.
+ *
+ * Requires objc_selector_lock to be locked.
+ */
+static inline void
+_sel_register_from_method_list_no_lock(objc_method_list *list, int index)
+{
+	for (int i = index; i < list->size; ++i){
 		Method m = &list->list[i];
 		m->selector = _sel_register_name_no_lock(m->selector_name,
 							 m->selector_types);
@@ -297,7 +564,7 @@ sel_registerName(const char *name, const char *types)
 		    "Not enough types for registering selector.");
 	
 	struct objc_selector *selector;
-	selector = objc_selector_table_get(objc_selector_hashtable, name);
+	selector = _objc_selector_table_get(name, objc_hash_string(name));
 	
 	if (selector != NULL){
 		const char *selector_types = _objc_selector_get_types(selector);
@@ -362,7 +629,6 @@ sel_getTypes(SEL selector)
 	objc_assert(sel_struct != NULL,
 		    "Trying to get types from an unregistered selector.");
 	
-	/* The types are in the same string as name, separated by \0 */
 	return _objc_selector_get_types(sel_struct);
 }
 
@@ -372,7 +638,7 @@ sel_getNamed(const char *name)
 	objc_assert(name != NULL, "Cannot get a selector for a NULL name!\n");
 	
 	struct objc_selector *selector;
-	selector = objc_selector_table_get(objc_selector_hashtable, name);
+	selector = _objc_selector_table_get(name, objc_hash_string(name));
 	
 	if (selector != NULL){
 		return selector->sel_uid;
@@ -390,25 +656,33 @@ sel_isEqual(SEL sel1, SEL sel2)
 PRIVATE void
 objc_register_selectors_from_method_list(objc_method_list *list)
 {
+	/*
+	 * Modules with a precomputed selector table have all their method
+	 * selectors registered by the time the method lists are processed, so
+	 * the lock is only needed for the selectors that aren't found.
+	 */
+	int index = _sel_lookup_from_method_list(list);
+	if (index == list->size){
+		return;
+	}
+	
 	OBJC_LOCK_FOR_SCOPE(&objc_selector_lock);
-	_sel_register_from_method_list_no_lock(list);
+	_sel_register_from_method_list_no_lock(list, index);
 }
 
 PRIVATE void
 objc_register_selectors_from_class(Class cl, Class meta)
 {
-	OBJC_LOCK_FOR_SCOPE(&objc_selector_lock);
-	
 	objc_method_list *list = cl->methods;
 	while (list != NULL){
-		_sel_register_from_method_list_no_lock(list);
+		objc_register_selectors_from_method_list(list);
 		list = list->next;
 	}
 	
 	if (meta != Nil){
 		list = meta->methods;
 		while (list != NULL){
-			_sel_register_from_method_list_no_lock(list);
+			objc_register_selectors_from_method_list(list);
 			list = list->next;
 		}
 	}
@@ -443,6 +717,36 @@ objc_register_selector_array(struct objc_selector_reference *selectors,
 }
 
 
+PRIVATE void
+objc_reserve_selectors(unsigned int count)
+{
+	OBJC_LOCK_FOR_SCOPE(&objc_selector_lock);
+	_objc_selector_table_reserve_no_lock(count);
+}
+
+PRIVATE void
+objc_register_selector_table(struct objc_precomputed_selector *selectors,
+			     unsigned int count)
+{
+	OBJC_LOCK_FOR_SCOPE(&objc_selector_lock);
+	
+	/*
+	 * Grow the table once for the whole module instead of doubling it
+	 * during the inserts. The selectors are unique within the table, so
+	 * count is an upper bound of the number of new selectors.
+	 */
+	_objc_selector_table_reserve_no_lock(count);
+	
+	for (unsigned int i = 0; i < count; ++i){
+		struct objc_precomputed_selector *selector = &selectors[i];
+		*(selector->sel_uid) =
+			_sel_register_hashed_name_no_lock(selector->selector_name,
+							  selector->selector_types,
+							  selector->hash);
+	}
+}
+
+
 #pragma mark -
 #pragma mark INIT_FUNCTION
 
@@ -458,14 +762,19 @@ objc_selector_init(void)
 	 * name for SEL.
 	 */
 	objc_selector_hashtable =
-		objc_selector_table_create(OBJC_SELECTOR_TABLE_INITIAL_CAPACITY);
+		_objc_selector_table_create(OBJC_SELECTOR_TABLE_INITIAL_CAPACITY);
 	
 	/*
-	 * Init RW lock for locking the string allocator. The
-	 * allocator itself is lazily allocated.
+	 * Init RW lock for locking the string arena. The
+	 * arena chunks are lazily allocated.
 	 */
 	objc_rw_lock_init(&objc_selector_lock, "objc_selector_lock");
 	
+	objc_selector_types_table_size = OBJC_SELECTOR_TYPES_TABLE_INITIAL_CAPACITY;
+	objc_selector_types_table =
+		objc_zero_alloc(objc_selector_types_table_size * sizeof(char *),
+				M_SELECTOR_MAP_TYPE);
+	
 	/*
 	 * Sparse array holding the SEL -> Selector mapping.
 	 */
@@ -511,12 +820,33 @@ objc_selector_destroy(void)
 	objc_rw_lock_destroy(&objc_selector_lock);
 	SparseArrayDestroy(&objc_selector_sparse);
 	
-	/* Free all the selectors and the table. */
-	objc_selector_table_destroy(objc_selector_hashtable,
-				    __objc_selector_deallocate);
+	/* Free all the selectors and the tables. */
+	struct objc_selector_table *table = objc_selector_hashtable;
+	for (uint32_t i = 0; i < table->size; ++i){
+		if (table->cells[i] != NULL){
+			__objc_selector_deallocate(table->cells[i]);
+		}
+	}
+	objc_dealloc(table, M_SELECTOR_MAP_TYPE);
+	
+	while (objc_selector_retired_tables != NULL){
+		table = objc_selector_retired_tables;
+		objc_selector_retired_tables = table->retired_next;
+		objc_dealloc(table, M_SELECTOR_MAP_TYPE);
+	}
 	
-	for (int i = 0; i < string_allocator_next_page_index; ++i) {
-		objc_dealloc(string_allocator_pages[i], M_SELECTOR_NAME_TYPE);
+	objc_debug_log("Selector strings used %llu bytes in %u chunks, %llu bytes"
+		       " wasted, %u type strings deduplicated.\n",
+		       (unsigned long long)objc_selector_arena_statistics.bytes_used,
+		       objc_selector_arena_statistics.chunk_count,
+		       (unsigned long long)objc_selector_arena_statistics.bytes_wasted,
+		       objc_selector_arena_statistics.types_deduplicated);
+	
+	objc_dealloc(objc_selector_types_table, M_SELECTOR_MAP_TYPE);
+	while (objc_selector_arena_chunks != NULL){
+		struct objc_selector_arena_chunk *chunk = objc_selector_arena_chunks;
+		objc_selector_arena_chunks = chunk->next;
+		objc_dealloc(chunk, M_SELECTOR_NAME_TYPE);
 	}
 }
 
@@ -40,6 +40,46 @@ struct objc_selector_reference {
 	SEL *sel_uid;
 };
 
+/*
+ * An entry of the precomputed selector table emitted by the compiler
+ * (objc_abi_version_kernel_2 and newer). The compiler emits each selector
+ * used by the module only once and hashes the name ahead of time.
+ */
+struct objc_precomputed_selector {
+	/* Selector name and types. */
+	const char *selector_name;
+	const char *selector_types;
+	
+	/*
+	 * Pointer to the variable with the actual SEL, which gets populated by the
+	 * runtime.
+	 */
+	SEL *sel_uid;
+	
+	/* Must be equal to objc_hash_string(selector_name). */
+	uint32_t hash;
+};
+
+/*
+ * Usage of the arena holding the selector names and types.
+ */
+struct objc_selector_arena_statistics {
+	/* Bytes allocated for the arena chunks and bytes taken by strings. */
+	uint64_t bytes_allocated;
+	uint64_t bytes_used;
+	
+	/* Bytes lost at the ends of chunks that were no longer being filled. */
+	uint64_t bytes_wasted;
+	
+	unsigned int chunk_count;
+	
+	/* Number of times existing type strings were reused. */
+	unsigned int types_deduplicated;
+};
+
+PRIVATE extern struct objc_selector_arena_statistics
+										objc_selector_arena_statistics;
+
 /*
  * Registers all selectors within the class or method list.
  */
@@ -48,4 +88,16 @@ PRIVATE void objc_register_selectors_from_class(Class cl, Class meta);
 PRIVATE void objc_register_selector_array(struct objc_selector_reference *selectors,
 										  unsigned int count);
 
+/*
+ * Makes room for count more selectors in the selector table, so that the
+ * table gets resized at most once when loading a batch of modules.
+ */
+PRIVATE void objc_reserve_selectors(unsigned int count);
+
+/*
+ * Merges a precomputed selector table into the run-time.
+ */
+PRIVATE void objc_register_selector_table(struct objc_precomputed_selector *selectors,
+										  unsigned int count);
+
 #endif /* !OBJC_SELECTOR_H_ */
@@ -12,8 +12,7 @@ objc_slot_create_for_method_in_class(Method method, Class class)
 	
 	struct objc_slot *slot = slot_pool_alloc();
 	slot->owner = class;
-	slot->types = method->selector_name +
-		      objc_strlen(method->selector_name) + 1;
+	slot->types = method->selector_types;
 	slot->selector = method->selector;
 	slot->implementation = method->implementation;
 	slot->version = 1;
@@ -1,15 +1,37 @@
 
+
+/*
+ * A spinlock taking up a cache line of its own, so that threads spinning on
+ * one lock don't slow down the owners of its neighbours. The contention
+ * counters share the line with the lock and are only updated by the thread
+ * that just acquired it after waiting, so they need neither atomic operations
+ * nor another cache line.
+ */
+struct objc_spinlock {
+	volatile int value;
+	
+	/* Acquisitions that had to wait for the lock. */
+	unsigned long contended;
+	
+	/* Backoff rounds spent waiting. */
+	unsigned long spins;
+	
+	/* Times the waiting thread gave up the CPU. */
+	unsigned long yields;
+} __attribute__((aligned(64)));
+
 #ifndef spinlock_do_not_allocate_page
 
 /*
- * Number of spinlocks.  This allocates one page on 32-bit platforms.
+ * Number of spinlocks. Being padded to a cache line each, they take up 64kB.
  */
 #define spinlock_count (1<<10)
 static const int spinlock_mask = spinlock_count - 1;
+
 /*
- * Integers used as spinlocks for atomic property access.
+ * Spinlocks used for atomic property access.
  */
-extern int spinlocks[spinlock_count];
+extern struct objc_spinlock spinlocks[spinlock_count];
 
 /*
  * Get a spin lock from a pointer.  We want to prevent lock contention between
@@ -19,19 +41,27 @@ extern int spinlocks[spinlock_count];
  * contention between the same property in different objects, so we can't just
  * use the ivar offset.
  */
-static inline volatile int *lock_for_pointer(const void *ptr)
+static inline unsigned int spinlock_index_for_pointer(const void *ptr)
 {
 	intptr_t hash = (intptr_t)ptr;
 	/* Most properties will be pointers, so disregard the lowest few bits */
-	hash >>= sizeof(void*) == 4 ? 2 : 8;
+	hash >>= sizeof(void*) == 4 ? 2 : 3;
 	intptr_t low = hash & spinlock_mask;
 	hash >>= 16;
 	hash |= low;
-	return spinlocks + (hash & spinlock_mask);
+	return (unsigned int)(hash & spinlock_mask);
+}
+
+static inline struct objc_spinlock *lock_for_pointer(const void *ptr)
+{
+	return &spinlocks[spinlock_index_for_pointer(ptr)];
 }
 
 #endif /* !spinlock_do_not_allocate_page */
 
+/* Upper bound of the pause hints per backoff round. */
+#define spinlock_max_backoff 1024
+
 /*
  * Unlocks the spinlock.  This is not an atomic operation.  We are only ever
  * modifying the lowest bit of the spinlock word, so it doesn't matter if this
@@ -39,10 +69,10 @@ static inline volatile int *lock_for_pointer(const void *ptr)
  * no possibility of contention among calls to this, because it may only be
  * called by the thread owning the spin lock.
  */
-inline static void unlock_spinlock(volatile int *spinlock)
+inline static void unlock_spinlock(struct objc_spinlock *spinlock)
 {
 	__sync_synchronize();
-	*spinlock = 0;
+	spinlock->value = 0;
 }
 /*
  * Attempts to lock a spinlock.  This is heavily optimised for the uncontended
@@ -52,27 +82,52 @@ inline static void unlock_spinlock(volatile int *spinlock)
  * may require locking a cache line in a cache-coherent SMP system, but it's a
  * lot cheaper than a system call).
  *
- * If the lock is contended, then we just sleep and then try again after the
- * other threads have run.  Note that there is no upper bound on the potential
- * running time of this function, which is one of the great many reasons that
- * using atomic accessors is a terrible idea, but in the common case it should
- * be very fast.
+ * If the lock is contended, we wait with plain reads until the lock looks
+ * free (so that the cache line isn't bounced between the waiters by the CAS),
+ * backing off exponentially with the CPU's pause hint. Once the backoff hits
+ * its bound, we let the other threads run before trying again.  Note that
+ * there is no upper bound on the potential running time of this function,
+ * which is one of the great many reasons that using atomic accessors is a
+ * terrible idea, but in the common case it should be very fast.
  */
-inline static void lock_spinlock(volatile int *spinlock)
+inline static void lock_spinlock(struct objc_spinlock *spinlock)
 {
-	int count = 0;
 	/* Set the spin lock value to 1 if it is 0. */
-	while(!__sync_bool_compare_and_swap(spinlock, 0, 1))
+	if (__sync_bool_compare_and_swap(&spinlock->value, 0, 1))
+	{
+		return;
+	}
+	
+	unsigned long spins = 0;
+	unsigned long yields = 0;
+	int backoff = 1;
+	do
 	{
-		count++;
-		if (0 == count % 10)
+		while (spinlock->value != 0)
 		{
-			/*
-			 * If it is already 1, let another thread play with the
-			 * CPU for a bit then try again.
-			 */
-			objc_yield();
+			++spins;
+			if (backoff < spinlock_max_backoff)
+			{
+				for (int i = 0; i < backoff; ++i)
+				{
+					objc_cpu_relax();
+				}
+				backoff <<= 1;
+			}
+			else
+			{
+				/*
+				 * The owner is probably not running, let it have the
+				 * CPU for a bit then try again.
+				 */
+				++yields;
+				objc_yield();
+			}
 		}
-	}
+	} while (!__sync_bool_compare_and_swap(&spinlock->value, 0, 1));
+	
+	/* The lock is ours, and so is its cache line. */
+	++spinlock->contended;
+	spinlock->spins += spins;
+	spinlock->yields += yields;
 }
-
@@ -0,0 +1,259 @@
+#include "os.h"
+#include "kernobjc/runtime.h"
+#include "types.h"
+#include "class.h"
+#include "init.h"
+#include "utils.h"
+
+/*
+ * Locks used by @synchronized. Each object being synchronized on gets an
+ * entry with a recursive mutex in a striped hash table keyed by the object's
+ * address. The entries are never freed while the run-time is loaded - once
+ * nobody uses an entry, it is reused for another object in the same stripe.
+ *
+ * Each thread also caches the entries it currently holds, so that nested
+ * @synchronized blocks on the same object don't touch the table at all.
+ */
+
+/* Must be a power of two. */
+#define OBJC_SYNC_STRIPES 64
+
+/* Number of held locks cached per thread. */
+#define OBJC_SYNC_CACHE_SIZE 8
+
+struct objc_sync_entry {
+	struct objc_sync_entry *next;
+	
+	id object;
+	
+	/* Number of threads holding or waiting for the mutex. */
+	volatile unsigned int users;
+	
+	objc_mutex mutex;
+};
+
+struct objc_sync_stripe {
+	objc_rw_lock lock;
+	struct objc_sync_entry *entries;
+} __attribute__((aligned(64)));
+
+struct objc_sync_cache_item {
+	id object;
+	struct objc_sync_entry *entry;
+	unsigned int lock_count;
+};
+
+struct objc_sync_thread_cache {
+	unsigned int count;
+	struct objc_sync_cache_item items[OBJC_SYNC_CACHE_SIZE];
+};
+
+static struct objc_sync_stripe objc_sync_table[OBJC_SYNC_STRIPES];
+static objc_tls_key objc_sync_cache_tls_key;
+
+static inline struct objc_sync_stripe *
+_objc_sync_stripe_for_object(id obj)
+{
+	uint32_t hash = (uint32_t)objc_hash_pointer(obj) * 0x9E3779B1;
+	return &objc_sync_table[(hash >> 26) & (OBJC_SYNC_STRIPES - 1)];
+}
+
+static inline struct objc_sync_thread_cache *
+_objc_sync_get_thread_cache(void)
+{
+	struct objc_sync_thread_cache *cache = (struct objc_sync_thread_cache*)
+				objc_get_tls_for_key(objc_sync_cache_tls_key);
+	if (cache == NULL){
+		cache = objc_zero_alloc(sizeof(struct objc_sync_thread_cache),
+					M_SYNC_TYPE);
+		objc_set_tls_for_key(cache, objc_sync_cache_tls_key);
+	}
+	return cache;
+}
+
+static inline struct objc_sync_cache_item *
+_objc_sync_cache_find(struct objc_sync_thread_cache *cache, id obj)
+{
+	for (unsigned int i = 0; i < cache->count; ++i){
+		if (cache->items[i].object == obj){
+			return &cache->items[i];
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Returns the entry for the object, registering the caller as one of its
+ * users. Entries of objects that nobody uses anymore are recycled.
+ */
+static struct objc_sync_entry *
+_objc_sync_acquire_entry(id obj)
+{
+	struct objc_sync_stripe *stripe = _objc_sync_stripe_for_object(obj);
+	struct objc_sync_entry *unused = NULL;
+	
+	OBJC_LOCK_FOR_SCOPE(&stripe->lock);
+	for (struct objc_sync_entry *entry = stripe->entries; entry != NULL;
+	     entry = entry->next){
+		if (entry->object == obj){
+			__sync_fetch_and_add(&entry->users, 1);
+			return entry;
+		}
+		if (unused == NULL && entry->users == 0){
+			unused = entry;
+		}
+	}
+	
+	/*
+	 * The users only drop to zero outside of the stripe lock, never the
+	 * other way round, so the unused entry can be taken over safely.
+	 */
+	if (unused != NULL){
+		unused->object = obj;
+		__sync_fetch_and_add(&unused->users, 1);
+		return unused;
+	}
+	
+	struct objc_sync_entry *entry = objc_zero_alloc(
+				sizeof(struct objc_sync_entry), M_SYNC_TYPE);
+	objc_mutex_init(&entry->mutex, "objc_sync_lock");
+	entry->object = obj;
+	entry->users = 1;
+	entry->next = stripe->entries;
+	stripe->entries = entry;
+	return entry;
+}
+
+static inline void
+_objc_sync_release_entry(struct objc_sync_entry *entry)
+{
+	objc_mutex_unlock(&entry->mutex);
+	__sync_fetch_and_sub(&entry->users, 1);
+}
+
+/*
+ * Returns the entry of the object that is locked by the current thread, or
+ * NULL. Only searches the thread's stripe and doesn't register a user.
+ */
+static struct objc_sync_entry *
+_objc_sync_find_entry(id obj)
+{
+	struct objc_sync_stripe *stripe = _objc_sync_stripe_for_object(obj);
+	struct objc_sync_entry *result = NULL;
+	
+	objc_rw_lock_rlock(&stripe->lock);
+	for (struct objc_sync_entry *entry = stripe->entries; entry != NULL;
+	     entry = entry->next){
+		if (entry->object == obj && entry->users > 0){
+			result = entry;
+			break;
+		}
+	}
+	objc_rw_lock_unlock(&stripe->lock);
+	return result;
+}
+
+static void
+_objc_sync_free_thread_cache(struct objc_sync_thread_cache *cache)
+{
+	if (cache->count != 0){
+		objc_log("Thread exiting while holding %u @synchronized locks!\n",
+			 cache->count);
+	}
+	objc_dealloc(cache, M_SYNC_TYPE);
+}
+
+#pragma mark -
+#pragma mark Public Functions
+
+int
+objc_sync_enter(id obj)
+{
+	if (obj == nil || objc_object_is_small_object(obj)){
+		return 0;
+	}
+	
+	struct objc_sync_thread_cache *cache = _objc_sync_get_thread_cache();
+	struct objc_sync_cache_item *item = _objc_sync_cache_find(cache, obj);
+	if (item != NULL){
+		/* Recursive @synchronized - the mutex is already held. */
+		++item->lock_count;
+		return 0;
+	}
+	
+	struct objc_sync_entry *entry = _objc_sync_acquire_entry(obj);
+	objc_mutex_lock(&entry->mutex);
+	
+	/*
+	 * If the cache is full, the entry is released directly through the
+	 * table, relying on the mutex being recursive.
+	 */
+	if (cache->count < OBJC_SYNC_CACHE_SIZE){
+		item = &cache->items[cache->count];
+		++cache->count;
+		item->object = obj;
+		item->entry = entry;
+		item->lock_count = 1;
+	}
+	return 0;
+}
+
+int
+objc_sync_exit(id obj)
+{
+	if (obj == nil || objc_object_is_small_object(obj)){
+		return 0;
+	}
+	
+	struct objc_sync_thread_cache *cache = _objc_sync_get_thread_cache();
+	struct objc_sync_cache_item *item = _objc_sync_cache_find(cache, obj);
+	if (item != NULL){
+		if (--item->lock_count == 0){
+			_objc_sync_release_entry(item->entry);
+			
+			--cache->count;
+			*item = cache->items[cache->count];
+		}
+		return 0;
+	}
+	
+	struct objc_sync_entry *entry = _objc_sync_find_entry(obj);
+	if (entry == NULL){
+		objc_abort("Unlocking an object that obviously wasn't locked.\n");
+		return 0;
+	}
+	
+	_objc_sync_release_entry(entry);
+	return 0;
+}
+
+#pragma mark -
+#pragma mark Init Functions
+
+PRIVATE void
+objc_sync_init(void)
+{
+	for (int i = 0; i < OBJC_SYNC_STRIPES; ++i){
+		objc_rw_lock_init(&objc_sync_table[i].lock,
+				  "objc_sync_stripe_lock");
+	}
+	objc_register_tls(&objc_sync_cache_tls_key,
+			  (objc_tls_descructor)_objc_sync_free_thread_cache);
+}
+
+PRIVATE void
+objc_sync_destroy(void)
+{
+	objc_deregister_tls(objc_sync_cache_tls_key);
+	
+	for (int i = 0; i < OBJC_SYNC_STRIPES; ++i){
+		struct objc_sync_stripe *stripe = &objc_sync_table[i];
+		while (stripe->entries != NULL){
+			struct objc_sync_entry *entry = stripe->entries;
+			stripe->entries = entry->next;
+			objc_mutex_destroy(&entry->mutex);
+			objc_dealloc(entry, M_SYNC_TYPE);
+		}
+		objc_rw_lock_destroy(&stripe->lock);
+	}
+}
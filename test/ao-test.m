@@ -2,17 +2,115 @@
 #import "../kernobjc/KKObjects.h"
 #include "../os.h"
 #include "../kernobjc/types.h"
+#include "../kernobjc/arc.h"
 #include "../types.h"
 #include "../associative.h"
 
 #include "../kernobjc/object.h"
 
+#define AO_RACE_VALUE_MAGIC 0xA55A
+#define AO_RACE_KEY_COUNT 1000
+
+void objc_test_run_threads(int count, void (*fn)(void *), void *arg);
+
+@interface KKAORaceValue : KKObject {
+	@public
+	volatile unsigned int magic;
+}
+@end
+@implementation KKAORaceValue
+-(id)init{
+	if ((self = [super init]) != nil){
+		magic = AO_RACE_VALUE_MAGIC;
+	}
+	return self;
+}
+-(void)dealloc{
+	magic = 0;
+	[super dealloc];
+}
+@end
+
+struct ao_race {
+	id object;
+	id filler;
+	volatile int started;
+	volatile int done;
+};
+
+static char ao_race_key;
+static char ao_race_keys[AO_RACE_KEY_COUNT];
+
+/*
+ * Keeps growing the reference table of the object while replacing the value
+ * under ao_race_key, so that the getter keeps finding the key in tables that
+ * are retired by the time it takes the lock.
+ */
+static void
+ao_race_grow(struct ao_race *race)
+{
+	for (int i = 0; i < AO_RACE_KEY_COUNT; ++i){
+		objc_set_associated_object(race->object, &ao_race_keys[i],
+								   race->filler,
+								   OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+		
+		id value = (id)[[KKAORaceValue alloc] init];
+		objc_set_associated_object(race->object, &ao_race_key, value,
+								   OBJC_ASSOCIATION_RETAIN);
+		objc_release(value);
+	}
+	race->done = 1;
+}
+
+static void
+ao_race_get(struct ao_race *race)
+{
+	while (!race->done){
+		KKAORaceValue *value = (KKAORaceValue*)
+				objc_get_associated_object(race->object, &ao_race_key);
+		if (value == nil){
+			continue;
+		}
+		objc_assert(value->magic == AO_RACE_VALUE_MAGIC,
+					"The atomic getter returned a released object!\n");
+		objc_release((id)value);
+	}
+}
+
+static void
+ao_race_thread(void *arg)
+{
+	struct ao_race *race = arg;
+	if (__sync_fetch_and_add(&race->started, 1) == 0){
+		ao_race_grow(race);
+	}else{
+		ao_race_get(race);
+	}
+}
+
+/* Grows the reference table while an atomic getter is running. */
+static void
+associated_objects_atomic_getter_race_test(void)
+{
+	struct ao_race race = {
+		.object = (id)[[KKObject alloc] init],
+		.filler = (id)[[KKObject alloc] init],
+		.started = 0,
+		.done = 0
+	};
+	
+	objc_test_run_threads(2, ao_race_thread, &race);
+	
+	objc_release(race.object);
+	objc_release(race.filler);
+}
+
 
 void associated_objects_test(void);
 void associated_objects_test(void){
 	typedef struct {
 		Class isa;
-		int retain_count;
+		objc_retain_count retain_count;
 	} Object;
 	
 	objc_log("===STARTING AO TEST===\n");
@@ -25,7 +123,12 @@ void associated_objects_test(void){
 	objc_set_associated_object((id)obj, key, (id)obj_to_associate, OBJC_ASSOCIATION_ASSIGN);
 	objc_set_associated_object((id)obj, key, nil, OBJC_ASSOCIATION_ASSIGN);
 	
+#if OBJC_ASSOCIATED_OBJECTS_SIDE_TABLE
+	objc_assert(!((Object*)obj)->isa->flags.fake, "The object shouldn't be of a fake class!\n");
+	objc_assert(((Object*)obj)->isa->flags.has_associated_objects, "The class should be marked as having associated objects!\n");
+#else
 	objc_assert(((Object*)obj)->isa->flags.fake, "The object should now be of a fake class!\n");
+#endif
 	objc_assert(!object_getClass((id)obj)->flags.fake, "objc_object_get_class() returned a fake class!\n");
 	objc_assert(((Object*)obj_to_associate)->retain_count == 0, "The associated object shouldn't have been released!\n");
 	
@@ -34,9 +137,24 @@ void associated_objects_test(void){
 	
 	objc_assert(((Object*)obj_to_associate)->retain_count == 0, "The associated have retain count 0!\n");
 	
+	/* Enough keys for the references to move into a hash table. */
+	static char keys[100];
+	for (int i = 0; i < 100; ++i){
+		objc_set_associated_object((id)obj, &keys[i], (id)obj_to_associate, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+	}
+	objc_assert(((Object*)obj_to_associate)->retain_count == 100, "The associated object should have been retained by each key!\n");
+	for (int i = 0; i < 100; ++i){
+		id value = objc_get_associated_object((id)obj, &keys[i]);
+		objc_assert(value == (id)obj_to_associate, "Wrong associated object for key %d!\n", i);
+		objc_release(value);
+	}
+	
 	[obj release];
+	objc_assert(((Object*)obj_to_associate)->retain_count == 0, "The associated objects should have been released with the object!\n");
 	[obj_to_associate release];
 	
+	associated_objects_atomic_getter_race_test();
+	
 	objc_log("===================\n");
 	objc_log("Passed associated object tests.\n\n");
 }
@@ -0,0 +1,141 @@
+#import "../kernobjc/runtime.h"
+#import "../os.h"
+#import "../arc.h"
+
+/* Enough objects to fill all but one of the cacheable pool pages. */
+#define AUTORELEASE_TEST_OBJECT_COUNT \
+	((OBJC_AUTORELEASE_POOL_CACHE_LIMIT - 1) * (PAGE_SIZE / sizeof(void*) - 2))
+
+static void autorelease_objects(void)
+{
+	void *pool = objc_autoreleasePoolPush();
+	for (int i = 0; i < AUTORELEASE_TEST_OBJECT_COUNT; ++i){
+		objc_autorelease((id)[[KKObject alloc] init]);
+	}
+	objc_autoreleasePoolPop(pool);
+}
+
+static void autorelease_pool_page_cache_test(void)
+{
+	struct objc_autorelease_statistics before;
+	struct objc_autorelease_statistics after;
+	
+	/* The first round may need to allocate the pages. */
+	autorelease_objects();
+	
+	objc_autorelease_get_thread_statistics(&before);
+	autorelease_objects();
+	objc_autorelease_get_thread_statistics(&after);
+	
+	objc_assert(after.pages_allocated == before.pages_allocated,
+				"Pool pages weren't reused!\n");
+	objc_assert(after.pages_reused >= before.pages_reused
+				+ OBJC_AUTORELEASE_POOL_CACHE_LIMIT - 2,
+				"Pool page reuse not accounted!\n");
+}
+
+static void autorelease_statistics_test(void)
+{
+	struct objc_autorelease_statistics before;
+	struct objc_autorelease_statistics inside;
+	struct objc_autorelease_statistics after;
+	
+	objc_autorelease_get_thread_statistics(&before);
+	
+	void *outer = objc_autoreleasePoolPush();
+	void *inner = objc_autoreleasePoolPush();
+	objc_autorelease((id)[[KKObject alloc] init]);
+	objc_autorelease((id)[[KKObject alloc] init]);
+	objc_autorelease_get_thread_statistics(&inside);
+	objc_autoreleasePoolPop(inner);
+	objc_autoreleasePoolPop(outer);
+	
+	objc_autorelease_get_thread_statistics(&after);
+	
+	objc_assert(inside.thread_count == 1, "No thread data!\n");
+	objc_assert(inside.objects_pending == before.objects_pending + 2,
+				"Pending objects not counted!\n");
+	objc_assert(inside.pool_depth == before.pool_depth + 2,
+				"Pool depth not counted!\n");
+	objc_assert(after.pool_peak_depth >= before.pool_depth + 2,
+				"Pool peak depth not counted!\n");
+	objc_assert(after.objects_pending == before.objects_pending,
+				"Pending objects not released!\n");
+	objc_assert(after.objects_autoreleased == before.objects_autoreleased + 2,
+				"Autoreleased objects not counted!\n");
+	objc_assert(after.pool_depth == before.pool_depth,
+				"Pool depth not restored!\n");
+	
+	struct objc_autorelease_statistics all;
+	objc_autorelease_get_statistics(&all);
+	objc_assert(all.thread_count >= 1 && all.objects_autoreleased
+				>= after.objects_autoreleased,
+				"Statistics not summed over threads!\n");
+}
+
+static BOOL returned_object_deallocated = NO;
+
+@interface KKReturnValueTest : KKObject
+@end
+@implementation KKReturnValueTest
+-(void)dealloc{
+	returned_object_deallocated = YES;
+	[super dealloc];
+}
+@end
+
+/* What an ARC callee returning a new object does. */
+static id return_value_test_callee(void)
+{
+	return objc_autoreleaseReturnValue((id)[[KKReturnValueTest alloc] init]);
+}
+
+static void return_value_handoff_test(void)
+{
+	struct objc_autorelease_statistics before;
+	struct objc_autorelease_statistics after;
+	
+	void *pool = objc_autoreleasePoolPush();
+	objc_autorelease_get_thread_statistics(&before);
+	
+	/*
+	 * Whether the object is handed over depends on the code the compiler
+	 * generated for the call site, but it is either handed over or in the pool.
+	 */
+	id obj = objc_retainAutoreleasedReturnValue(return_value_test_callee());
+	objc_autorelease_get_thread_statistics(&after);
+	objc_assert(after.objects_handed_over - before.objects_handed_over
+				+ after.objects_autoreleased - before.objects_autoreleased == 1,
+				"The returned object got lost!\n");
+	objc_release(obj);
+	
+	/*
+	 * A non-ARC caller keeps the object at +0 and expects it to live until the
+	 * pool is popped. A later claim of the same pointer must not take over the
+	 * pool's reference.
+	 */
+	returned_object_deallocated = NO;
+	objc_autorelease_get_thread_statistics(&before);
+	obj = return_value_test_callee();
+	id claimed = objc_retainAutoreleasedReturnValue(obj);
+	objc_autorelease_get_thread_statistics(&after);
+	objc_assert(after.objects_handed_over == before.objects_handed_over,
+				"A pending object was taken over by the wrong caller!\n");
+	objc_release(claimed);
+	objc_assert(!returned_object_deallocated,
+				"The object was released before the pool was popped!\n");
+	
+	objc_autoreleasePoolPop(pool);
+	objc_assert(returned_object_deallocated,
+				"The returned object wasn't released by the pool!\n");
+}
+
+void autorelease_test(void);
+void autorelease_test(void){
+	autorelease_pool_page_cache_test();
+	autorelease_statistics_test();
+	return_value_handoff_test();
+	
+	objc_log("===================\n");
+	objc_log("Passed autorelease tests.\n\n");
+}
@@ -0,0 +1,74 @@
+#import "../../kernobjc/runtime.h"
+#import "../../kernobjc/KKObjects.h"
+#import "../../os.h"
+#import "../../private.h"
+
+/*
+ * Measures the cost of getting and setting associated objects on objects
+ * with 1, 10 and 1000 keys - i.e. with the references stored inline and in
+ * a hash table. Load the module after the runtime and the results get
+ * printed to the console.
+ */
+
+#define ITERATIONS 1000000
+#define MAX_KEYS 1000
+
+void ao_bench_run(void);
+
+static char keys[MAX_KEYS];
+
+static void
+bench_log(const char *name, unsigned int key_count, uint64_t elapsed)
+{
+	objc_log("%-16s %4u keys %4u.%02u ns/op\n", name, key_count,
+			 (unsigned)(elapsed / ITERATIONS),
+			 (unsigned)((elapsed * 100 / ITERATIONS) % 100));
+}
+
+static void
+bench(unsigned int key_count)
+{
+	Class cl = objc_getClass("KKObject");
+	id object = [cl new];
+	id value = [cl new];
+	
+	for (unsigned int i = 0; i < key_count; ++i){
+		objc_setAssociatedObject(object, &keys[i], value,
+								 OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+	}
+	
+	uint64_t start = objc_uptime_nanoseconds();
+	for (int i = 0; i < ITERATIONS; ++i){
+		id result = objc_getAssociatedObject(object, &keys[i % key_count]);
+		objc_release(result);
+	}
+	bench_log("get nonatomic", key_count, objc_uptime_nanoseconds() - start);
+	
+	start = objc_uptime_nanoseconds();
+	for (int i = 0; i < ITERATIONS; ++i){
+		objc_setAssociatedObject(object, &keys[i % key_count], value,
+								 OBJC_ASSOCIATION_RETAIN);
+	}
+	bench_log("set atomic", key_count, objc_uptime_nanoseconds() - start);
+	
+	start = objc_uptime_nanoseconds();
+	for (int i = 0; i < ITERATIONS; ++i){
+		id result = objc_getAssociatedObject(object, &keys[i % key_count]);
+		objc_release(result);
+	}
+	bench_log("get atomic", key_count, objc_uptime_nanoseconds() - start);
+	
+	[object release];
+	[value release];
+}
+
+void
+ao_bench_run(void)
+{
+	objc_log("===================\n");
+	objc_log("Associated objects benchmark (%d operations each)\n", ITERATIONS);
+	bench(1);
+	bench(10);
+	bench(MAX_KEYS);
+	objc_log("===================\n");
+}
@@ -0,0 +1,73 @@
+#import "../../kernobjc/runtime.h"
+#import "../../kernobjc/KKObjects.h"
+#import "../../os.h"
+#import "../../private.h"
+#import "../../types.h"
+#import "../../sarray2.h"
+
+/*
+ * Measures the cost of objc_msgSend for the common kinds of sends. Load the
+ * module after the runtime and the results get printed to the console.
+ */
+
+#define ITERATIONS 10000000
+
+void msgsend_bench_run(void);
+
+id objc_msgSend(id, SEL, ...);
+
+@interface MsgSendBench : KKObject
+- (id)hit;
+@end
+
+@implementation MsgSendBench
+- (id)hit
+{
+	return self;
+}
+@end
+
+typedef id (*send_fn)(id, SEL);
+
+/*
+ * The send goes through a volatile function pointer so that the compiler
+ * can't hoist it out of the loop.
+ */
+static void
+bench(const char *name, id receiver, SEL selector)
+{
+	send_fn volatile send = (send_fn)objc_msgSend;
+	
+	uint64_t start = objc_uptime_nanoseconds();
+	for (int i = 0; i < ITERATIONS; ++i){
+		send(receiver, selector);
+	}
+	uint64_t elapsed = objc_uptime_nanoseconds() - start;
+	
+	objc_log("%-16s %4u.%02u ns/send\n", name,
+			 (unsigned)(elapsed / ITERATIONS),
+			 (unsigned)((elapsed * 100 / ITERATIONS) % 100));
+}
+
+void
+msgsend_bench_run(void)
+{
+	Class cl = objc_getClass("MsgSendBench");
+	id object = [cl new];
+	
+	/* Make sure the dtable is installed before measuring. */
+	[object hit];
+	
+	/* Otherwise the "hit" case would measure the slow path. */
+	objc_assert(!SparseArrayIsCompact(cl->dtable),
+				"MsgSendBench should have a regular dtable!\n");
+	
+	objc_log("===================\n");
+	objc_log("objc_msgSend benchmark (%d sends each)\n", ITERATIONS);
+	bench("hit", object, @selector(hit));
+	bench("nil receiver", nil, @selector(hit));
+	bench("slow path", object, sel_registerName("missing", "@@:"));
+	objc_log("===================\n");
+	
+	[object release];
+}
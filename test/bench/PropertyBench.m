@@ -0,0 +1,144 @@
+#import "../../kernobjc/runtime.h"
+#import "../../kernobjc/KKObjects.h"
+#import "../../os.h"
+#import "../../private.h"
+#import "../../spinlock.h"
+
+/*
+ * Compares the lock-free atomic property accessors with the spinlock-based
+ * ones they replaced, with several threads reading one shared property and,
+ * optionally, one of them writing it. Load the module after the runtime and
+ * the results get printed to the console.
+ */
+
+#define ITERATIONS 1000000
+#define POOL_BATCH 1000
+
+void property_bench_run(void);
+void objc_test_run_threads(int count, void (*fn)(void *), void *arg);
+
+@interface PropertyBench : KKObject {
+@public
+	id value;
+}
+@end
+
+@implementation PropertyBench
+@end
+
+/*
+ * The spinlock variant is what the accessors did before they became lock-free,
+ * with the runtime's lock_for_pointer() and lock_spinlock(). The runtime's
+ * lock table is private, so the bench has a table of its own.
+ */
+struct objc_spinlock spinlocks[spinlock_count];
+
+static id
+spinlock_get(PropertyBench *object)
+{
+	struct objc_spinlock *lock = lock_for_pointer(&object->value);
+	lock_spinlock(lock);
+	id ret = objc_retain(object->value);
+	unlock_spinlock(lock);
+	return objc_autorelease(ret);
+}
+
+static void
+spinlock_set(PropertyBench *object, id arg)
+{
+	arg = objc_retain(arg);
+	struct objc_spinlock *lock = lock_for_pointer(&object->value);
+	lock_spinlock(lock);
+	id old = object->value;
+	object->value = arg;
+	unlock_spinlock(lock);
+	objc_release(old);
+}
+
+struct bench_run {
+	PropertyBench *object;
+	ptrdiff_t offset;
+	BOOL lock_free;
+	
+	/* The first thread to start becomes the writer, if set. */
+	BOOL with_writer;
+	volatile int started;
+};
+
+static void
+bench_thread(void *arg)
+{
+	struct bench_run *run = arg;
+	BOOL writer = run->with_writer
+				  && __sync_fetch_and_add(&run->started, 1) == 0;
+	id object = (id)run->object;
+	id value = objc_retain(run->object->value);
+	
+	for (int i = 0; i < ITERATIONS; i += POOL_BATCH){
+		void *pool = objc_autoreleasePoolPush();
+		for (int j = 0; j < POOL_BATCH; ++j){
+			if (writer){
+				if (run->lock_free){
+					objc_setProperty_atomic(object, NULL, value, run->offset);
+				}else{
+					spinlock_set(run->object, value);
+				}
+			}else{
+				if (run->lock_free){
+					objc_getProperty(object, NULL, run->offset, YES);
+				}else{
+					spinlock_get(run->object);
+				}
+			}
+		}
+		objc_autoreleasePoolPop(pool);
+	}
+	
+	objc_release(value);
+}
+
+static void
+bench(const char *name, int threads, BOOL lock_free, BOOL with_writer)
+{
+	Class cl = objc_getClass("PropertyBench");
+	PropertyBench *object = [cl new];
+	object->value = [cl new];
+	
+	struct bench_run run = {
+		.object = object,
+		.offset = ivar_getOffset(class_getInstanceVariable(cl, "value")),
+		.lock_free = lock_free,
+		.with_writer = with_writer
+	};
+	
+	uint64_t start = objc_uptime_nanoseconds();
+	objc_test_run_threads(threads, bench_thread, &run);
+	uint64_t elapsed = objc_uptime_nanoseconds() - start;
+	
+	objc_log("%-10s %2d threads%s %6u.%02u ns/access\n", name, threads,
+			 with_writer ? " + writer" : "         ",
+			 (unsigned)(elapsed / ITERATIONS),
+			 (unsigned)((elapsed * 100 / ITERATIONS) % 100));
+	
+	objc_release(object->value);
+	[object release];
+}
+
+void
+property_bench_run(void)
+{
+	static const int thread_counts[] = { 1, 2, 4, 8 };
+	
+	objc_log("===================\n");
+	objc_log("Atomic property benchmark (%d accesses per thread)\n",
+			 ITERATIONS);
+	for (int i = 0; i < 4; ++i){
+		bench("spinlock", thread_counts[i], NO, NO);
+		bench("lock-free", thread_counts[i], YES, NO);
+	}
+	for (int i = 1; i < 4; ++i){
+		bench("spinlock", thread_counts[i], NO, YES);
+		bench("lock-free", thread_counts[i], YES, YES);
+	}
+	objc_log("===================\n");
+}
@@ -0,0 +1,50 @@
+#include <sys/types.h>
+#include <sys/cdefs.h>
+#include <sys/module.h>
+#include <sys/param.h>
+#include <sys/module.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/linker.h>
+#include <sys/limits.h>
+
+#include "../../os.h"
+#include "../../kernobjc/types.h"
+#include "../../loader.h"
+
+void msgsend_bench_run(void);
+void ao_bench_run(void);
+void property_bench_run(void);
+
+static int event_handler(struct module *module, int event, void *arg) {
+	int e = 0;
+	switch (event) {
+		case MOD_LOAD:
+			_objc_load_kernel_module(module);
+			msgsend_bench_run();
+			ao_bench_run();
+			property_bench_run();
+			break;
+		case MOD_UNLOAD:
+			if (!_objc_unload_kernel_module(module)){
+				e = EOPNOTSUPP;
+			}
+			break;
+		default:
+			e = EOPNOTSUPP;
+			break;
+	}
+	return (e);
+}
+
+static moduledata_t objc_bench_conf = {
+	"objc_bench", 	/* Module name. */
+	event_handler,  /* Event handler. */
+	NULL 		/* Extra data */
+};
+
+DECLARE_MODULE(objc_bench, objc_bench_conf, SI_SUB_DRIVERS, SI_ORDER_MIDDLE);
+MODULE_VERSION(objc_bench, 0);
+
+/* Depend on libobjc */
+MODULE_DEPEND(objc_bench, libobjc, 0, 0, 999);
@@ -4,6 +4,7 @@
 #include "../os.h"
 #include "../types.h"
 #include "../utils.h"
+#include "../selector.h"
 
 static BOOL methodCalled = NO;
 
@@ -36,6 +37,16 @@ void many_selectors_test(void){
 		
 		sel_size += objc_strlen(selBuffer);
 	}
+	
+	/* All the selectors share the same types. */
+	objc_assert(objc_selector_arena_statistics.types_deduplicated >= 0x1000 - 1,
+				"Types not deduplicated!\n");
+	objc_assert(objc_selector_arena_statistics.bytes_used >= sel_size,
+				"Arena usage not accounted!\n");
+	objc_assert(objc_selector_arena_statistics.bytes_used
+				+ objc_selector_arena_statistics.bytes_wasted
+				<= objc_selector_arena_statistics.bytes_allocated,
+				"Arena statistics inconsistent!\n");
 	objc_assert(class_addMethod(object_getClass([KKObject class]), nextSel, (IMP)x, "@@:"),
 		   "Couldn't add method!");
 	objc_assert(cls == [KKObject class], "Wrong class!\n");
@@ -55,5 +66,43 @@ void many_selectors_test(void){
 	objc_log("Passed many selectors tests.\n\n");
 }
 
-
-
+void precomputed_selector_table_test(void);
+void precomputed_selector_table_test(void){
+	SEL init_sel = 0;
+	SEL new_sel = 0;
+	SEL other_sel = 0;
+	struct objc_precomputed_selector table[] = {
+		{ "init", "@16@0:8", &init_sel, 0 },
+		{ "precomputedSelector", "v16@0:8", &new_sel, 0 },
+		{ "otherPrecomputedSelector:", "v24@0:8@16", &other_sel, 0 }
+	};
+	if (sizeof(void*) == 4){
+		table[0].selector_types = "@8@0:4";
+		table[1].selector_types = "v8@0:4";
+		table[2].selector_types = "v12@0:4@8";
+	}
+	for (int i = 0; i < 3; ++i){
+		table[i].hash = objc_hash_string(table[i].selector_name);
+	}
+	
+	objc_register_selector_table(table, 3);
+	
+	objc_assert(init_sel == @selector(init), "Existing selector not reused!\n");
+	objc_assert(new_sel != 0 && other_sel != 0 && new_sel != other_sel,
+				"Selectors not registered!\n");
+	objc_assert(new_sel == sel_getNamed("precomputedSelector"),
+				"Wrong selector registered!\n");
+	objc_assert(strcmp(sel_getName(other_sel), "otherPrecomputedSelector:") == 0,
+				"Wrong selector name!\n");
+	objc_assert(strcmp(sel_getTypes(other_sel), table[2].selector_types) == 0,
+				"Wrong selector types!\n");
+	
+	/* Registering the table again must yield the same selectors. */
+	SEL previous_sel = new_sel;
+	new_sel = 0;
+	objc_register_selector_table(table, 3);
+	objc_assert(new_sel == previous_sel, "Selector registered twice!\n");
+	
+	objc_log("===================\n");
+	objc_log("Passed precomputed selector table tests.\n\n");
+}
@@ -5,6 +5,8 @@
 
 #import "../sarray2.h"
 #import "../dtable.h"
+#import "../method_cache.h"
+#import "../associative.h"
 
 #ifdef _KERNEL
 	#include <machine/stdarg.h>
@@ -17,6 +19,7 @@
 
 id objc_msgSend(id, SEL, ...);
 void objc_msgSend_stret(id, SEL, ...);
+id objc_msgSendSuper(struct objc_super *, SEL, ...);
 
 typedef struct { int a,b,c,d,e; } s;
 @interface Fake
@@ -74,8 +77,166 @@ Class TestCls;
 	@throw self;
 }
 + nothing { return 0; }
++ cached { return (id)0x42; }
 @end
 
+static id cached_override(id self, SEL _cmd)
+{
+	return (id)0x43;
+}
+
+static void call_site_cache_test(void)
+{
+	Class sub = objc_allocateClassPair(TestCls, "MessageCacheTest", 0);
+	objc_registerClassPair(sub);
+	
+	struct objc_call_site_cache cache = { 0 };
+	
+	/* The first lookup installs the dtable, the second one fills the cache. */
+	id receiver = (id)sub;
+	struct objc_slot *slot;
+	for (int i = 0; i < 3; ++i){
+		slot = objc_msg_lookup_cached(&receiver, @selector(cached), nil,
+									  &cache);
+		assert(slot->implementation(receiver, @selector(cached)) == (id)0x42);
+	}
+	assert(cache.cls == sub);
+	assert(cache.slot == slot);
+	
+	/* Overriding the method in the subclass invalidates the cached slot. */
+	class_addMethod(object_getClass((id)sub), @selector(cached),
+					(IMP)cached_override, "@@:");
+	assert(cache.version != cache.slot->version);
+	slot = objc_msg_lookup_cached(&receiver, @selector(cached), nil, &cache);
+	assert(slot->implementation(receiver, @selector(cached)) == (id)0x43);
+	assert(cache.slot == slot);
+	assert([sub cached] == (id)0x43);
+}
+
+static id nothing_override(id self, SEL _cmd)
+{
+	return (id)0x44;
+}
+
+static void method_cache_test(void)
+{
+	Class sub = objc_allocateClassPair(TestCls, "MethodCacheTest", 0);
+	objc_registerClassPair(sub);
+	
+	/* The first lookup installs the dtable, the second one fills the cache. */
+	id receiver = (id)sub;
+	struct objc_slot *slot = NULL;
+	for (int i = 0; i < 2; ++i){
+		slot = objc_msg_lookup_sender(&receiver, @selector(nothing), nil);
+	}
+	assert(objc_method_cache_lookup(object_getClass((id)sub),
+									@selector(nothing)) == slot);
+	
+	/* Adding a method flushes the cache. */
+	class_addMethod(object_getClass((id)sub), @selector(nothing),
+					(IMP)nothing_override, "@@:");
+	assert(objc_method_cache_lookup(object_getClass((id)sub),
+									@selector(nothing)) == NULL);
+	slot = objc_msg_lookup_sender(&receiver, @selector(nothing), nil);
+	assert(slot->implementation(receiver, @selector(nothing)) == (id)0x44);
+	
+	/* Misses are cached as well, until a method gets added. */
+	SEL missing = sel_registerName("methodCacheMissing", "@@:");
+	assert(!class_respondsToSelector(object_getClass((id)sub), missing));
+	assert(objc_method_cache_lookup(object_getClass((id)sub), missing)
+		   == OBJC_METHOD_CACHE_ABSENT);
+	assert(!class_respondsToSelector(object_getClass((id)sub), missing));
+	class_addMethod(object_getClass((id)sub), missing,
+					(IMP)nothing_override, "@@:");
+	assert(class_respondsToSelector(object_getClass((id)sub), missing));
+}
+
+static void uninstalled_method_cache_test(void)
+{
+	Class sub = objc_allocateClassPair(TestCls, "UninstalledCacheTest", 0);
+	class_addMethod(sub, @selector(nothing), (IMP)nothing_override, "@@:");
+	objc_registerClassPair(sub);
+	
+	/* Nothing was sent to the class yet, so its method lists get walked. */
+	assert(sub->dtable == uninstalled_dtable);
+	assert(class_getMethodImplementation(sub, @selector(nothing))
+		   == (IMP)nothing_override);
+	struct objc_method *method =
+		objc_method_cache_lookup_method(sub, @selector(nothing));
+	assert(method != NULL && method->implementation == (IMP)nothing_override);
+	
+	/* Misses in the class's own lists are cached too. */
+	SEL missing = sel_registerName("uninstalledCacheMissing", "@@:");
+	assert(!class_respondsToSelector(sub, missing));
+	assert(objc_method_cache_lookup_method(sub, missing)
+		   == (struct objc_method *)OBJC_METHOD_CACHE_ABSENT);
+	class_addMethod(sub, missing, (IMP)nothing_override, "@@:");
+	assert(objc_method_cache_lookup_method(sub, missing) == NULL);
+	assert(class_respondsToSelector(sub, missing));
+	
+	/* Once the dtable is installed, lookups go through it instead. */
+	id object = class_createInstance(sub, 0);
+	assert(objc_msgSend(object, @selector(nothing)) == (id)0x44);
+	assert(sub->dtable != uninstalled_dtable);
+	assert(class_getMethodImplementation(sub, @selector(nothing))
+		   == (IMP)nothing_override);
+	assert(objc_method_cache_lookup(sub, @selector(nothing))->implementation
+		   == (IMP)nothing_override);
+	object_dispose(object);
+}
+
+static void compact_dtable_test(void)
+{
+	Class sub = objc_allocateClassPair(TestCls, "CompactDtableTest", 0);
+	class_addMethod(sub, @selector(nothing), (IMP)nothing_override, "@@:");
+	objc_registerClassPair(sub);
+	
+	/* Ordinary classes keep the dtables objc_msgSend looks up inline. */
+	assert([sub foo] == (id)0x42);
+	Class meta = object_getClass((id)sub);
+	assert(!SparseArrayIsCompact(meta->dtable));
+	
+#if !OBJC_ASSOCIATED_OBJECTS_SIDE_TABLE
+	/* Fake classes of associated objects get compact ones. */
+	static char key;
+	id object = class_createInstance(sub, 0);
+	objc_setAssociatedObject(object, &key, nil, OBJC_ASSOCIATION_ASSIGN);
+	assert(objc_msgSend(object, @selector(nothing)) == (id)0x44);
+	
+	Class fake = *(Class*)object;
+	assert(fake->flags.fake);
+	assert(SparseArrayIsCompact(fake->dtable));
+	assert(SparseArraySize(fake->dtable) < 256 * sizeof(void*));
+	object_dispose(object);
+#endif
+}
+
+static void shared_slot_test(void)
+{
+	Class parent = objc_allocateClassPair(TestCls, "SharedSlotParent", 0);
+	objc_registerClassPair(parent);
+	Class child = objc_allocateClassPair(parent, "SharedSlotChild", 0);
+	objc_registerClassPair(child);
+	
+	assert([child foo] == (id)0x42);
+	
+	/* Subclasses share the slot of the method added to the superclass. */
+	class_addMethod(object_getClass((id)parent), @selector(nothing),
+					(IMP)nothing_override, "@@:");
+	struct objc_slot *slot =
+		objc_get_slot(object_getClass((id)parent), @selector(nothing));
+	assert(slot->owner == object_getClass((id)parent));
+	assert(objc_get_slot(object_getClass((id)child), @selector(nothing)) == slot);
+	assert([child nothing] == (id)0x44);
+	
+	struct objc_super sup = { (id)child, object_getClass((id)TestCls) };
+	assert(objc_msgSendSuper(&sup, @selector(nothing)) == nil);
+	sup.class = object_getClass((id)parent);
+	assert(objc_msgSendSuper(&sup, @selector(nothing)) == (id)0x44);
+	sup.receiver = nil;
+	assert(objc_msgSendSuper(&sup, @selector(nothing)) == nil);
+}
+
 void message_send_test(void);
 void message_send_test(void) {
 	TestCls = objc_getClass("MessageTest");
@@ -119,6 +280,12 @@ void message_send_test(void) {
 	}
 	Fake *f = nil;
 	assert(0 == [f izero]);
+	
+	call_site_cache_test();
+	method_cache_test();
+	uninstalled_method_cache_test();
+	compact_dtable_test();
+	shared_slot_test();
     
     objc_log("===================\n");
 	objc_log("Passed message send tests.\n\n");
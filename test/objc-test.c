@@ -91,6 +91,8 @@ static void list_classes(void){
 
 void associated_objects_test(void);
 void weak_ref_test(void);
+void autorelease_test(void);
+void retain_count_test(void);
 void ivar_test(void);
 void handmade_class_test(void);
 void compiler_test(void);
@@ -102,6 +104,7 @@ void property_introspection_test1(void);
 void property_introspection_test2(void);
 void protocol_creation_test(void);
 void many_selectors_test(void);
+void precomputed_selector_table_test(void);
 void runtime_test(void);
 void category_test(void);
 void load_test(void);
@@ -118,6 +121,8 @@ void run_tests(void)
 	
 	associated_objects_test();
 	weak_ref_test();
+	autorelease_test();
+	retain_count_test();
 	ivar_test();
 	
 	compiler_test();
@@ -133,6 +138,7 @@ void run_tests(void)
 	protocol_as_object_test();
 	block_test();
 	string_test();
+	precomputed_selector_table_test();
 	
 	//property_introspection_test2();
 	
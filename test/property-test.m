@@ -1,6 +1,7 @@
 #include "../kernobjc/runtime.h"
 #include "../os.h"
 #include "../utils.h"
+#import "../kernobjc/KKObjects.h"
 
 #ifdef __has_attribute
 #if __has_attribute(objc_root_class)
@@ -18,6 +19,79 @@ __attribute__((objc_root_class))
 + (Class)class { return self; }
 @end
 
+static BOOL other_value_deallocated = NO;
+
+@interface KKAtomicHolder : KKObject {
+	@public
+	id value;
+	id other;
+}
+@end
+@implementation KKAtomicHolder
+@end
+
+@interface KKOtherValue : KKObject
+@end
+@implementation KKOtherValue
+-(void)dealloc{
+	other_value_deallocated = YES;
+	[super dealloc];
+}
+@end
+
+static KKAtomicHolder *retain_setter_holder;
+
+/* A value whose -retain sets another atomic property of the holder. */
+@interface KKRetainSetter : KKObject
+@end
+@implementation KKRetainSetter
+-(id)retain{
+	ptrdiff_t offset = ivar_getOffset(class_getInstanceVariable(
+				[KKAtomicHolder class], "other"));
+	id other = (id)[[KKObject alloc] init];
+	objc_setProperty_atomic((id)retain_setter_holder, NULL, other, offset);
+	objc_release(other);
+	return [super retain];
+}
+@end
+
+/* A setter called from within an atomic getter mustn't wait for it. */
+static void property_atomic_retain_setter_test(void)
+{
+	ptrdiff_t value_offset = ivar_getOffset(class_getInstanceVariable(
+				[KKAtomicHolder class], "value"));
+	ptrdiff_t other_offset = ivar_getOffset(class_getInstanceVariable(
+				[KKAtomicHolder class], "other"));
+	
+	retain_setter_holder = [[KKAtomicHolder alloc] init];
+	id value = (id)[[KKRetainSetter alloc] init];
+	id other = (id)[[KKOtherValue alloc] init];
+	objc_setProperty_atomic((id)retain_setter_holder, NULL, value,
+							value_offset);
+	objc_setProperty_atomic((id)retain_setter_holder, NULL, other,
+							other_offset);
+	objc_release(other);
+	
+	void *pool = objc_autoreleasePoolPush();
+	id result = objc_getProperty((id)retain_setter_holder, NULL, value_offset,
+								 YES);
+	objc_assert(result == value, "Wrong atomic property value!\n");
+	objc_assert(!other_value_deallocated, "The old value of the property was "
+				"released while a getter could have been using it!\n");
+	objc_autoreleasePoolPop(pool);
+	
+	/* Put aside by the setter in -retain, released by the next setter. */
+	objc_setProperty_atomic((id)retain_setter_holder, NULL, nil,
+							other_offset);
+	objc_assert(other_value_deallocated,
+				"The old value of the property wasn't released!\n");
+	
+	objc_setProperty_atomic((id)retain_setter_holder, NULL, nil,
+							value_offset);
+	objc_release(value);
+	[retain_setter_holder release];
+}
+
 void property_test(void);
 void property_test(void) {
 	unsigned int outCount;
@@ -56,6 +130,21 @@ void property_test(void) {
 	}
 	objc_dealloc(properties, M_PROPERTY_TYPE);
 	objc_assert(found == 1, "Couldn't find the added property!");
+	
+	/* Uncontended struct accesses don't show up in the statistics. */
+	struct objc_spinlock_statistics before;
+	struct objc_spinlock_statistics after;
+	long src = 1;
+	long dest = 0;
+	objc_spinlock_get_statistics(&before);
+	objc_getPropertyStruct(&dest, &src, sizeof(long), YES, NO);
+	objc_setPropertyStruct(&dest, &src, sizeof(long), YES, NO);
+	objc_spinlock_get_statistics(&after);
+	objc_assert(dest == src, "The struct property wasn't copied!\n");
+	objc_assert(after.contended == before.contended,
+				"Uncontended spinlock counted as contended!\n");
+	
+	property_atomic_retain_setter_test();
     
     objc_log("===================\n");
 	objc_log("Passed property test.\n\n");
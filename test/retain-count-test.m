@@ -0,0 +1,52 @@
+#import "../kernobjc/runtime.h"
+#import "../os.h"
+#import "../types.h"
+#import "../refcount.h"
+
+static BOOL saturated_object_deallocated = NO;
+
+@interface KKRetainCountTest : KKObject
+@end
+@implementation KKRetainCountTest
+-(void)dealloc{
+	saturated_object_deallocated = YES;
+	[super dealloc];
+}
+@end
+
+static void retain_count_saturation_test(void)
+{
+	id obj = (id)[[KKRetainCountTest alloc] init];
+	struct objc_refcounted_object *object =
+					(struct objc_refcounted_object *)obj;
+	
+	/* Pretend the object has been retained almost up to the limit. */
+	object->retain_count = OBJC_RETAIN_COUNT_MAX - 1;
+	
+	for (int i = 0; i < 4; ++i){
+		objc_retain(obj);
+	}
+	objc_assert(object->retain_count == OBJC_RETAIN_COUNT_MAX,
+				"The retain count isn't saturated!\n");
+	
+	for (int i = 0; i < 4; ++i){
+		objc_release(obj);
+	}
+	objc_assert(object->retain_count == OBJC_RETAIN_COUNT_MAX - 1,
+				"The side table retains weren't released!\n");
+	objc_assert(!saturated_object_deallocated,
+				"The object was deallocated prematurely!\n");
+	
+	object->retain_count = 0;
+	objc_release(obj);
+	objc_assert(saturated_object_deallocated,
+				"The object wasn't deallocated!\n");
+}
+
+void retain_count_test(void);
+void retain_count_test(void){
+	retain_count_saturation_test();
+	
+	objc_log("===================\n");
+	objc_log("Passed retain count tests.\n\n");
+}
@@ -236,11 +236,39 @@ static void testAllocateClass()
   objc_log("testAllocateClass() ran\n");
 }
 
+static void testLoaderStatistics()
+{
+  struct objc_loader_statistics stats;
+  objc_loader_get_statistics(&stats);
+  /* At least this test module has been loaded. */
+  test(stats.module_count > 0);
+  test(stats.class_count > 0);
+  objc_log("Loaded %u classes in %u modules, resolving took %llu ns\n",
+           stats.class_count, stats.module_count,
+           (unsigned long long)stats.resolving);
+  objc_log("testLoaderStatistics() ran\n");
+}
+
 static void testSynchronized()
 {
   FooRT *foo = [FooRT new];
   objc_log("Enter synchronized code\n");
   [foo synchronizedCode];
+  @synchronized(foo) {
+    @synchronized(foo) { [foo synchronizedCode]; }
+  }
+  /* More objects than the per-thread cache of held locks can take. */
+  id objects[16];
+  for (int i = 0; i < 16; ++i) {
+    objects[i] = [FooRT new];
+    objc_sync_enter(objects[i]);
+    objc_sync_enter(objects[i]);
+  }
+  for (int i = 15; i >= 0; --i) {
+    objc_sync_exit(objects[i]);
+    objc_sync_exit(objects[i]);
+    [objects[i] release];
+  }
   [foo release];
   [FooRT shared];
   objc_log("testSynchronized() ran\n");
@@ -290,6 +318,7 @@ void runtime_test(void)
 	testProtocols();
 	testClassHierarchy();
 	testAllocateClass();
+	testLoaderStatistics();
 	objc_log("Instance of __NSObject: %p\n", class_createInstance([__NSObject class], 0));
 	
 	testSynchronized();
@@ -0,0 +1,54 @@
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/kernel.h>
+#include <sys/systm.h>
+#include <sys/proc.h>
+#include <sys/kthread.h>
+
+/*
+ * Thread helper shared by the tests and the benchmarks (see bench/Makefile).
+ */
+
+void objc_test_run_threads(int count, void (*fn)(void *), void *arg);
+
+struct objc_test_threads {
+	void (*fn)(void *);
+	void *arg;
+	volatile int remaining;
+};
+
+static void
+objc_test_thread(void *data)
+{
+	struct objc_test_threads *threads = data;
+	threads->fn(threads->arg);
+	if (__sync_sub_and_fetch(&threads->remaining, 1) == 0){
+		wakeup(threads);
+	}
+	kthread_exit();
+}
+
+/*
+ * Runs fn(arg) on count kernel threads and waits for all of them. Threads that
+ * can't be created are skipped.
+ */
+void
+objc_test_run_threads(int count, void (*fn)(void *), void *arg)
+{
+	struct objc_test_threads threads = {
+		.fn = fn,
+		.arg = arg,
+		.remaining = count
+	};
+	
+	for (int i = 0; i < count; ++i){
+		if (kthread_add(objc_test_thread, &threads, NULL, NULL, 0, 0,
+				"objc_test%d", i) != 0){
+			printf("Couldn't create test thread %d\n", i);
+			__sync_sub_and_fetch(&threads.remaining, 1);
+		}
+	}
+	while (threads.remaining != 0){
+		tsleep(&threads, 0, "objctst", hz / 10);
+	}
+}
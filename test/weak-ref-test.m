@@ -36,6 +36,71 @@ static void weak_ref_test_manual(void){
   
 }
 
+static void weak_ref_test_multiple_referrers(void){
+	weak_obj_deallocated = NO;
+	
+	KKObject *obj = [[KKWeakRefTest alloc] init];
+	id weak_refs[8];
+	for (int i = 0; i < 8; ++i){
+		objc_initWeak(&weak_refs[i], (id)obj);
+	}
+	
+	id moved_ref;
+	objc_moveWeak(&moved_ref, &weak_refs[0]);
+	objc_assert(weak_refs[0] == nil, "The moved weak ref isn't nil!\n");
+	objc_assert(moved_ref == (id)obj, "The weak ref wasn't moved!\n");
+	
+	objc_destroyWeak(&weak_refs[1]);
+	
+	id loaded = objc_loadWeakRetained(&weak_refs[2]);
+	objc_assert(loaded == (id)obj, "Couldn't load the weak ref!\n");
+	objc_release(loaded);
+	
+	objc_release((id)obj);
+	
+	objc_assert(weak_obj_deallocated, "The object should have been deallocated!\n");
+	objc_assert(moved_ref == nil, "The moved weak ref isn't zeroed out!\n");
+	for (int i = 2; i < 8; ++i){
+		objc_assert(weak_refs[i] == nil, "The weak ref isn't zeroed out!\n");
+	}
+}
+
+static void weak_ref_test_deallocating(void){
+	typedef struct {
+		id isa;
+		objc_retain_count retain_count;
+	} Object;
+	
+	KKObject *obj = [[KKWeakRefTest alloc] init];
+	id weak_ref;
+	objc_initWeak(&weak_ref, (id)obj);
+	
+	/* Pretend the last release is in progress. */
+	((Object*)obj)->retain_count = -1;
+	objc_assert(objc_loadWeakRetained(&weak_ref) == nil,
+				"A deallocating object has been retained!\n");
+	objc_assert(((Object*)obj)->retain_count == -1,
+				"A deallocating object has been resurrected!\n");
+	
+	((Object*)obj)->retain_count = 0;
+	objc_release((id)obj);
+	objc_assert(weak_ref == nil, "The weak ref isn't zeroed out!\n");
+}
+
+/* -[KKObject release] goes to -dealloc without objc_release(). */
+static void weak_ref_test_mrr_release(void){
+	weak_obj_deallocated = NO;
+	
+	KKObject *obj = [[KKWeakRefTest alloc] init];
+	id weak_ref;
+	objc_initWeak(&weak_ref, (id)obj);
+	
+	[obj release];
+	
+	objc_assert(weak_obj_deallocated, "The object should have been deallocated!\n");
+	objc_assert(weak_ref == nil, "The weak ref isn't zeroed out!\n");
+}
+
 static void weak_ref_test_compiler(void){
   // TODO
 }
@@ -44,5 +109,8 @@ static void weak_ref_test_compiler(void){
 void weak_ref_test(void);
 void weak_ref_test(void){
   weak_ref_test_manual();
+  weak_ref_test_multiple_referrers();
+  weak_ref_test_deallocating();
+  weak_ref_test_mrr_release();
   weak_ref_test_compiler();
 }
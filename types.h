@@ -6,19 +6,23 @@
  * Actual declarations of the structures follow.
  */
 struct objc_selector {
-	/* 
-	 * Name of the selector, followed by \0,
-	 * followed by the types, followed by \0.
-	 *
-	 * For example: "init\0@@:\0"
-	 */
+	/* Name of the selector. */
 	const char	*name;
 	
+	/* Types of the selector, shared by all selectors with equal types. */
+	const char	*types;
+	
 	/*
 	 * On registering, the selUID is populated and is
 	 * the pointer into the selector table.
 	 */
-	uint16_t	sel_uid;
+	SEL		sel_uid;
+	
+	/*
+	 * objc_hash_string() of the name, kept so that the selector table
+	 * doesn't need to rehash the name when it's being resized.
+	 */
+	uint32_t	hash;
 };
 
 struct objc_method {
@@ -87,6 +91,18 @@ typedef struct {
 	 * the flags.
 	 */
 	BOOL		fake : 1;
+	
+	/*
+	 * Some instance of the class has been weakly referenced, so the weak
+	 * reference table needs to be cleared on deallocation.
+	 */
+	BOOL		has_weak_refs : 1;
+	
+	/*
+	 * Some instance of the class has associated objects in the global
+	 * associated objects table.
+	 */
+	BOOL		has_associated_objects : 1;
 } objc_class_flags;
 
 #define OBJC_CLASS_COMMON_FIELDS											\
@@ -146,6 +162,25 @@ struct objc_slot {
 	SEL selector;
 };
 
+/*
+ * A per-call-site cache. The compiler emits one of these (zero-initialized)
+ * for each message send and passes it to objc_msg_lookup_cached. The entry
+ * is valid as long as the receiver's class matches, the slot's version
+ * hasn't been bumped (the method hasn't been replaced or overridden) and
+ * no dtable has been freed since (see objc_dtable_generation), which
+ * guards against a new class being allocated at the address of a freed one.
+ *
+ * The seq field is a sequence lock - it is odd while the entry is being
+ * written. Readers retry the global lookup when they see it change.
+ */
+struct objc_call_site_cache {
+	unsigned int seq;
+	unsigned int version;
+	Class cls;
+	struct objc_slot *slot;
+	unsigned long generation;
+};
+
 #include "list_types.h"
 #include "loader.h"
 
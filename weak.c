@@ -0,0 +1,334 @@
+#include "os.h"
+#include "kernobjc/types.h"
+#include "types.h"
+#include "weak.h"
+#include "init.h"
+#include "utils.h"
+
+/*
+ * Number of referrers kept directly in the entry. Most weakly referenced
+ * objects (delegates, parents) have just one or two of them.
+ */
+#define OBJC_WEAK_INLINE_REFERRERS 4
+
+struct objc_weak_entry {
+	id object;
+	
+	unsigned int count;
+	unsigned int capacity;
+	
+	/* Points to inline_referrers unless there are too many referrers. */
+	id **referrers;
+	id *inline_referrers[OBJC_WEAK_INLINE_REFERRERS];
+};
+
+/*
+ * Each stripe is an open-addressed hash table of entries, using linear
+ * probing. Entries are removed by shifting the following entries back, so no
+ * tombstones are needed. The stripes are aligned to cache lines, so that
+ * threads locking different stripes don't share the lock's cache line.
+ */
+struct objc_weak_stripe {
+	objc_rw_lock lock;
+	struct objc_weak_entry **entries;
+	unsigned int size;
+	unsigned int used;
+} __attribute__((aligned(64)));
+
+static struct objc_weak_stripe objc_weak_table[OBJC_WEAK_TABLE_STRIPES];
+
+/*
+ * The high bits select the stripe, the low bits the position within the
+ * stripe's table.
+ */
+static inline uint32_t
+_objc_weak_hash(id obj)
+{
+	return (uint32_t)objc_hash_pointer(obj) * 0x9E3779B1;
+}
+
+static inline struct objc_weak_stripe *
+_objc_weak_stripe_for_object(id obj)
+{
+	unsigned int index = _objc_weak_hash(obj) >> 26;
+	return &objc_weak_table[index & (OBJC_WEAK_TABLE_STRIPES - 1)];
+}
+
+static inline unsigned int
+_objc_weak_stripe_index(struct objc_weak_stripe *stripe, id obj)
+{
+	return _objc_weak_hash(obj) & (stripe->size - 1);
+}
+
+/*
+ * Returns the table slot that contains the object's entry, or NULL.
+ */
+static struct objc_weak_entry **
+_objc_weak_stripe_find(struct objc_weak_stripe *stripe, id obj)
+{
+	if (stripe->size == 0){
+		return NULL;
+	}
+	
+	unsigned int mask = stripe->size - 1;
+	unsigned int i = _objc_weak_stripe_index(stripe, obj);
+	while (stripe->entries[i] != NULL){
+		if (stripe->entries[i]->object == obj){
+			return &stripe->entries[i];
+		}
+		i = (i + 1) & mask;
+	}
+	return NULL;
+}
+
+static void
+_objc_weak_stripe_insert(struct objc_weak_stripe *stripe,
+			 struct objc_weak_entry *entry)
+{
+	unsigned int mask = stripe->size - 1;
+	unsigned int i = _objc_weak_stripe_index(stripe, entry->object);
+	while (stripe->entries[i] != NULL){
+		i = (i + 1) & mask;
+	}
+	stripe->entries[i] = entry;
+	++stripe->used;
+}
+
+/*
+ * Keeps the load factor at 75 % at most.
+ */
+static void
+_objc_weak_stripe_grow_if_necessary(struct objc_weak_stripe *stripe)
+{
+	if ((stripe->used + 1) * 4 <= stripe->size * 3){
+		return;
+	}
+	
+	struct objc_weak_entry **old_entries = stripe->entries;
+	unsigned int old_size = stripe->size;
+	
+	stripe->size = old_size == 0 ? 8 : old_size * 2;
+	stripe->entries = objc_zero_alloc(stripe->size *
+				sizeof(struct objc_weak_entry *), M_WEAK_REF_TYPE);
+	stripe->used = 0;
+	
+	for (unsigned int i = 0; i < old_size; ++i){
+		if (old_entries[i] != NULL){
+			_objc_weak_stripe_insert(stripe, old_entries[i]);
+		}
+	}
+	
+	if (old_entries != NULL){
+		objc_dealloc(old_entries, M_WEAK_REF_TYPE);
+	}
+}
+
+static void
+_objc_weak_stripe_remove(struct objc_weak_stripe *stripe,
+			 struct objc_weak_entry **slot)
+{
+	unsigned int mask = stripe->size - 1;
+	unsigned int i = (unsigned int)(slot - stripe->entries);
+	unsigned int j = i;
+	
+	stripe->entries[i] = NULL;
+	--stripe->used;
+	
+	/* Move back the entries that would no longer be found. */
+	while (YES){
+		j = (j + 1) & mask;
+		struct objc_weak_entry *entry = stripe->entries[j];
+		if (entry == NULL){
+			break;
+		}
+		
+		unsigned int home = _objc_weak_stripe_index(stripe, entry->object);
+		BOOL reachable = (i <= j) ? (i < home && home <= j)
+					  : (i < home || home <= j);
+		if (!reachable){
+			stripe->entries[i] = entry;
+			stripe->entries[j] = NULL;
+			i = j;
+		}
+	}
+}
+
+static void
+_objc_weak_entry_free(struct objc_weak_entry *entry)
+{
+	if (entry->referrers != entry->inline_referrers){
+		objc_dealloc(entry->referrers, M_WEAK_REF_TYPE);
+	}
+	objc_dealloc(entry, M_WEAK_REF_TYPE);
+}
+
+#pragma mark -
+#pragma mark Private Functions
+
+PRIVATE void
+objc_weak_table_lock(id obj1, id obj2, BOOL write)
+{
+	struct objc_weak_stripe *first = obj1 == nil ? NULL :
+					_objc_weak_stripe_for_object(obj1);
+	struct objc_weak_stripe *second = obj2 == nil ? NULL :
+					_objc_weak_stripe_for_object(obj2);
+	if (first == second){
+		second = NULL;
+	}else if (first == NULL || (second != NULL && second < first)){
+		struct objc_weak_stripe *tmp = first;
+		first = second;
+		second = tmp;
+	}
+	
+	if (first != NULL){
+		if (write){
+			objc_rw_lock_wlock(&first->lock);
+		}else{
+			objc_rw_lock_rlock(&first->lock);
+		}
+	}
+	if (second != NULL){
+		if (write){
+			objc_rw_lock_wlock(&second->lock);
+		}else{
+			objc_rw_lock_rlock(&second->lock);
+		}
+	}
+}
+
+PRIVATE void
+objc_weak_table_unlock(id obj1, id obj2)
+{
+	struct objc_weak_stripe *first = obj1 == nil ? NULL :
+					_objc_weak_stripe_for_object(obj1);
+	struct objc_weak_stripe *second = obj2 == nil ? NULL :
+					_objc_weak_stripe_for_object(obj2);
+	if (first != NULL){
+		objc_rw_lock_unlock(&first->lock);
+	}
+	if (second != NULL && second != first){
+		objc_rw_lock_unlock(&second->lock);
+	}
+}
+
+PRIVATE void
+objc_weak_table_register_no_lock(id obj, id *addr)
+{
+	struct objc_weak_stripe *stripe = _objc_weak_stripe_for_object(obj);
+	struct objc_weak_entry **slot = _objc_weak_stripe_find(stripe, obj);
+	struct objc_weak_entry *entry;
+	if (slot == NULL){
+		entry = objc_zero_alloc(sizeof(struct objc_weak_entry),
+					M_WEAK_REF_TYPE);
+		entry->object = obj;
+		entry->capacity = OBJC_WEAK_INLINE_REFERRERS;
+		entry->referrers = entry->inline_referrers;
+		
+		_objc_weak_stripe_grow_if_necessary(stripe);
+		_objc_weak_stripe_insert(stripe, entry);
+	}else{
+		entry = *slot;
+		for (unsigned int i = 0; i < entry->count; ++i){
+			if (entry->referrers[i] == addr){
+				return;
+			}
+		}
+	}
+	
+	if (entry->count == entry->capacity){
+		unsigned int capacity = entry->capacity * 2;
+		id **referrers = objc_alloc(capacity * sizeof(id *),
+					    M_WEAK_REF_TYPE);
+		objc_copy_memory(referrers, entry->referrers,
+				 entry->count * sizeof(id *));
+		if (entry->referrers != entry->inline_referrers){
+			objc_dealloc(entry->referrers, M_WEAK_REF_TYPE);
+		}
+		entry->referrers = referrers;
+		entry->capacity = capacity;
+	}
+	
+	entry->referrers[entry->count] = addr;
+	++entry->count;
+}
+
+PRIVATE void
+objc_weak_table_unregister_no_lock(id obj, id *addr)
+{
+	struct objc_weak_stripe *stripe = _objc_weak_stripe_for_object(obj);
+	struct objc_weak_entry **slot = _objc_weak_stripe_find(stripe, obj);
+	if (slot == NULL){
+		return;
+	}
+	
+	struct objc_weak_entry *entry = *slot;
+	for (unsigned int i = 0; i < entry->count; ++i){
+		if (entry->referrers[i] == addr){
+			--entry->count;
+			entry->referrers[i] = entry->referrers[entry->count];
+			break;
+		}
+	}
+	
+	if (entry->count == 0){
+		_objc_weak_stripe_remove(stripe, slot);
+		_objc_weak_entry_free(entry);
+	}
+}
+
+PRIVATE void
+objc_weak_table_clear(id obj)
+{
+	struct objc_weak_stripe *stripe = _objc_weak_stripe_for_object(obj);
+	
+	objc_rw_lock_wlock(&stripe->lock);
+	struct objc_weak_entry **slot = _objc_weak_stripe_find(stripe, obj);
+	if (slot == NULL){
+		objc_rw_lock_unlock(&stripe->lock);
+		return;
+	}
+	
+	struct objc_weak_entry *entry = *slot;
+	for (unsigned int i = 0; i < entry->count; ++i){
+		id *addr = entry->referrers[i];
+		if (*addr == obj){
+			*addr = nil;
+		}
+	}
+	_objc_weak_stripe_remove(stripe, slot);
+	objc_rw_lock_unlock(&stripe->lock);
+	
+	_objc_weak_entry_free(entry);
+}
+
+#pragma mark -
+#pragma mark Init Functions
+
+PRIVATE void
+objc_weak_table_init(void)
+{
+	/* A weak store or move locks the stripes of two objects at once. */
+	for (int i = 0; i < OBJC_WEAK_TABLE_STRIPES; ++i){
+		objc_rw_lock_init_dupok(&objc_weak_table[i].lock,
+					"objc_weak_table_stripe_lock");
+	}
+}
+
+PRIVATE void
+objc_weak_table_destroy(void)
+{
+	for (int i = 0; i < OBJC_WEAK_TABLE_STRIPES; ++i){
+		struct objc_weak_stripe *stripe = &objc_weak_table[i];
+		for (unsigned int j = 0; j < stripe->size; ++j){
+			if (stripe->entries[j] != NULL){
+				_objc_weak_entry_free(stripe->entries[j]);
+			}
+		}
+		if (stripe->entries != NULL){
+			objc_dealloc(stripe->entries, M_WEAK_REF_TYPE);
+		}
+		stripe->entries = NULL;
+		stripe->size = stripe->used = 0;
+		objc_rw_lock_destroy(&stripe->lock);
+	}
+}
@@ -0,0 +1,40 @@
+/*
+ * A table of zeroing weak references, keyed by the address of the weakly
+ * referenced object. For each object, it keeps the addresses of all the weak
+ * variables referencing it, so that they can be zeroed out when the object
+ * gets deallocated.
+ *
+ * The table is split into OBJC_WEAK_TABLE_STRIPES independently locked
+ * stripes, so that only weak references to objects hashing into the same
+ * stripe serialize. The stripe's lock also protects the weak variables
+ * pointing to the objects in the stripe.
+ */
+
+#ifndef OBJC_WEAK_H_
+#define OBJC_WEAK_H_
+
+/* Must be a power of two. */
+#define OBJC_WEAK_TABLE_STRIPES 64
+
+/*
+ * Locks the stripes of both objects, in a fixed order so that two threads
+ * can't deadlock. Either object may be nil. Reading only requires the lock
+ * for reading.
+ */
+PRIVATE void	objc_weak_table_lock(id obj1, id obj2, BOOL write);
+PRIVATE void	objc_weak_table_unlock(id obj1, id obj2);
+
+/*
+ * Adds or removes the weak variable at addr to/from the object's referrers.
+ * The object's stripe needs to be locked for writing.
+ */
+PRIVATE void	objc_weak_table_register_no_lock(id obj, id *addr);
+PRIVATE void	objc_weak_table_unregister_no_lock(id obj, id *addr);
+
+/*
+ * Zeroes out all weak variables referencing the object and removes the
+ * object from the table. Locks the object's stripe.
+ */
+PRIVATE void	objc_weak_table_clear(id obj);
+
+#endif /* !OBJC_WEAK_H_ */